@@ -163,10 +163,11 @@ public sealed class OVROverlay : IOverlay
 
     public void Render()
     {
-        if (_overlay == null || _parent.Texture == null)
+        var texture = _parent.DisplayTexture;
+        if (_overlay == null || texture == null)
             return;
 
-        UploadTexture(_overlay, _parent.Texture);
+        UploadTexture(_overlay, texture);
     }
 
     public void Show()
@@ -0,0 +1,39 @@
+using WlxOverlay.Numerics;
+using WlxOverlay.Types;
+
+namespace WlxOverlay.Capture;
+
+/// <summary>
+/// Resolves the output_size option, which downscales CPU captures before they are uploaded.
+/// </summary>
+public static class CaptureScale
+{
+    // enum scale_format in lib/common/scale.h
+    public const int FormatRGB = 2;
+
+    /// <summary>
+    /// The size a screen should be uploaded at, never larger than the source.
+    /// </summary>
+    public static Vector2Int TargetSize(string screenName, Vector2Int sourceSize)
+    {
+        if (Config.Instance.OutputSize == null
+            || !Config.Instance.OutputSize.TryGetValue(screenName, out var size)
+            || size.Length != 2 || size[0] <= 0 || size[1] <= 0)
+            return sourceSize;
+
+        return new Vector2Int(Math.Min(size[0], sourceSize.X), Math.Min(size[1], sourceSize.Y));
+    }
+
+    /// <summary>
+    /// The largest integer factor that still gives at least the configured size.
+    /// Used by captures that are updated in damaged rects, which can only be scaled on their own by a box filter.
+    /// </summary>
+    public static int BoxFactor(string screenName, Vector2Int sourceSize)
+    {
+        var target = TargetSize(screenName, sourceSize);
+        if (target.X <= 0 || target.Y <= 0)
+            return 1;
+
+        return Math.Max(1, Math.Min(sourceSize.X / target.X, sourceSize.Y / target.Y));
+    }
+}
@@ -0,0 +1,29 @@
+namespace WlxOverlay.Capture;
+
+/// <summary>
+/// Receives the log messages of the native capture libraries, so that they are
+/// written whole instead of being interleaved with other console output.
+/// </summary>
+internal static class NativeLog
+{
+    private const int LevelWarn = 2;
+    private const int LevelError = 3;
+
+    private delegate void LogDelegate(int level, IntPtr message);
+
+    // kept alive for as long as the native side may call it
+    private static readonly LogDelegate Delegate = OnLog;
+
+    public static IntPtr Handle { get; } = Marshal.GetFunctionPointerForDelegate(Delegate);
+
+    private static void OnLog(int level, IntPtr message)
+    {
+        var prefix = level switch
+        {
+            >= LevelError => "ERR ",
+            LevelWarn => "WARN ",
+            _ => ""
+        };
+        Console.WriteLine(prefix + Marshal.PtrToStringAnsi(message));
+    }
+}
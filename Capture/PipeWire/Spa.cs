@@ -12,6 +12,20 @@ public struct spa_rectangle
     public uint height;
 }
 
+[StructLayout(LayoutKind.Sequential)]
+public struct spa_point
+{
+    public int x;
+    public int y;
+}
+
+[StructLayout(LayoutKind.Sequential)]
+public struct spa_region
+{
+    public spa_point position;
+    public spa_rectangle size;
+}
+
 [StructLayout(LayoutKind.Sequential)]
 public struct spa_video_info
 {
@@ -1,9 +1,9 @@
-using Tmds.Linux;
 using WlxOverlay.Backend;
 using WlxOverlay.Capture.PipeWire;
 using WlxOverlay.Desktop;
 using WlxOverlay.GFX;
 using WlxOverlay.GFX.OpenGL;
+using WlxOverlay.Numerics;
 using WlxOverlay.Types;
 
 namespace WlxOverlay.Capture;
@@ -25,29 +25,84 @@ public class PipeWireCapture : IDesktopCapture
         [12] = DrmFormat.DRM_FORMAT_ARGB8888, // SPA_VIDEO_FORMAT_BGRA
     };
 
+    private static readonly IReadOnlyDictionary<uint, GraphicsFormat> SpaCursorFormats = new Dictionary<uint, GraphicsFormat>
+    {
+        [7] = GraphicsFormat.RGBA8,  // SPA_VIDEO_FORMAT_RGBx
+        [8] = GraphicsFormat.BGRA8,  // SPA_VIDEO_FORMAT_BGRx
+        [11] = GraphicsFormat.RGBA8, // SPA_VIDEO_FORMAT_RGBA
+        [12] = GraphicsFormat.BGRA8, // SPA_VIDEO_FORMAT_BGRA
+    };
+
     private readonly uint _nodeId;
     private readonly string _name;
+    private readonly bool _cursorMetadata;
     private uint _width;
     private uint _height;
 
     private nint _handle;
 
-    private nint _onFrameHandle;
-    private OnFrameDelegate? _onFrameDelegate;
+    // PipeWire cycles through a few DMA-BUFs, each is imported once
+    private readonly EglImageCache _images = new();
 
-    private nint _eglImage;
-    private nint _lastEglImage;
+    // spa_video_format and modifier of the last acquired frame, _width and _height are its size
+    private uint _format;
+    private ulong _modifier;
+
+    // PipeWire removed buffers since the images were made, their fds may be reused for new ones
+    private uint _buffersGeneration;
+
+    // frames are leased from libwlxpw, so PipeWire cannot reuse a buffer while it is read
+    private unsafe wlxpw_frame* _lease;
+    private unsafe wlxpw_frame* _lastLease;
 
-    private readonly object _attribsLock = new();
     private readonly nint[] _attribs = new nint[47];
 
+    // downscaled frame, when output_size is set for this screen
+    private IntPtr _scaleBuf;
+    private int _scaleBufSize;
+
+    // full size cpu frames only upload the tiles that changed
+    private readonly TileDiff _diff = new();
+
+    // the texture holds the previous acquired frame, so the damage of the next one is all that changed
+    private bool _damageApplies;
+
+    // with cursor metadata, frames land here and the cursor is drawn on top of them into the overlay
+    private GlTexture? _captureTex;
+    private bool _hasFrame;
+
+    private readonly object _cursorLock = new();
+    private ITexture? _cursorTex;
+    private byte[]? _cursorPixels;
+    private GraphicsFormat _cursorFormat;
+    private uint _cursorWidth;
+    private uint _cursorHeight;
+    private uint _cursorSerial;
+    private Vector2Int _cursorPos;
+    private Vector2Int _cursorHot;
+    private bool _cursorVisible;
+    private bool _cursorChanged;
+
+    private nint _onCursorHandle;
+    private OnCursorDelegate? _onCursorDelegate;
+
+    private DateTime _nextLatencyLog = DateTime.MinValue;
+
+    private Vector2Int _requestedSize;
+    private uint _requestedFps;
+
     private static string? _pwVersion;
 
+    // one PipeWire loop thread and connection for all screens
+    private static nint _session;
+    private static int _numStreams;
+
     private static IntPtr _dmaBufFormats = IntPtr.Zero;
 
-    public PipeWireCapture(BaseOutput output, uint nodeId)
+    public PipeWireCapture(BaseOutput output, uint nodeId, bool cursorMetadata = false)
     {
         _nodeId = nodeId;
+        _cursorMetadata = cursorMetadata;
         _name = output.Name;
         _width = (uint)output.Size.X;
         _height = (uint)output.Size.Y;
@@ -55,6 +110,8 @@ public class PipeWireCapture : IDesktopCapture
 
     public static void Load()
     {
+        wlxpw_set_log(NativeLog.Handle);
+
         _pwVersion = Marshal.PtrToStringAnsi(pw_get_library_version());
         Console.WriteLine("PipeWire version: " + _pwVersion);
 
@@ -123,65 +180,292 @@ public class PipeWireCapture : IDesktopCapture
     public unsafe bool TryApplyToTexture(ITexture texture)
     {
         var retVal = false;
-        if (texture is not GlTexture glTexture)
+        if (texture is not GlTexture overlayTexture || _handle == IntPtr.Zero)
             return retVal;
 
-        if (_lastEglImage != IntPtr.Zero)
-            EGL.DestroyImage(EGL.Display, _lastEglImage);
+        var glTexture = _cursorMetadata
+            ? _captureTex ??= (GlTexture)GraphicsEngine.Instance.EmptyTexture(_width, _height, internalFormat: GraphicsFormat.RGB8, dynamic: true)
+            : overlayTexture;
 
-        lock (_attribsLock)
+        // the texture no longer samples the previous frame, so its buffer can go back
+        if (_lastLease != null)
         {
-            if (_attribs[0] == (nint)EglEnum.Width)
+            wlxpw_release(_handle, _lastLease);
+            _lastLease = null;
+        }
+
+        // the image keeps the DMA-BUF alive, only the duplicated fds are left to close
+        if (_lease != null && _lease->removed != 0)
+        {
+            wlxpw_release(_handle, _lease);
+            _lease = null;
+        }
+
+        var pb = wlxpw_acquire_latest(_handle);
+        if (pb != null)
+        {
+            var keepLease = false;
+            var error = EglEnum.Success;
+
+            // the damage of this frame is lost unless it is uploaded below
+            var damageApplies = _damageApplies;
+            _damageApplies = false;
+
+            if (pb->buffers_generation != _buffersGeneration)
             {
-                _lastEglImage = _eglImage;
-                _eglImage = EGL.CreateImage(EGL.Display, IntPtr.Zero, EglEnum.LinuxDmaBufExt, IntPtr.Zero, _attribs);
-                var error = EGL.GetError();
-                if (error != EglEnum.Success)
-                    throw new ApplicationException($"{error} on eglCreateImage!");
-
-                glTexture.Resize(_width, _height);
-                glTexture.LoadEglImage(_eglImage, _width, _height);
-                retVal = true;
+                _images.Clear();
+                _buffersGeneration = pb->buffers_generation;
             }
-            else if (_attribs[0] == (nint)spa_data_type.SPA_DATA_MemPtr)
+
+            // renegotiated buffers get new images
+            if (pb->format != _format || pb->modifier != _modifier || pb->width != _width || pb->height != _height)
             {
-                var fmt = Config.Instance.WaylandColorSwap
-                    ? GraphicsFormat.RGBA8
-                    : GraphicsFormat.BGRA8;
+                _images.Clear();
+                _format = pb->format;
+                _modifier = pb->modifier;
+                _width = pb->width;
+                _height = pb->height;
+                damageApplies = false;
+            }
 
-                glTexture.Resize(_width, _height);
-                texture.LoadRawImage(_attribs[1], fmt, _width, _height);
-                retVal = true;
+            // a MemPtr buffer cannot be removed by PipeWire until its frame is released
+            try
+            {
+                switch (pb->type)
+                {
+                    case spa_data_type.SPA_DATA_DmaBuf:
+                        {
+                            BuildDmaBufAttribs(pb);
+                            var image = _images.GetOrCreate(_attribs, out error);
+                            if (image == IntPtr.Zero)
+                                break;
+
+                            glTexture.Resize(_width, _height);
+                            glTexture.LoadEglImage(image, _width, _height);
+                            _diff.Reset();
+
+                            // the texture reads from the buffer until the next frame replaces it
+                            _lastLease = _lease;
+                            _lease = pb;
+                            keepLease = true;
+                            retVal = true;
+                            break;
+                        }
+                    case spa_data_type.SPA_DATA_MemPtr:
+                    case spa_data_type.SPA_DATA_MemFd:
+                        {
+                            // MemFd buffers stay mapped by libwlxpw for as long as the frame is leased
+                            if (pb->data == IntPtr.Zero)
+                                break;
+
+                            _damageApplies = LoadMapped(glTexture, pb, damageApplies);
+                            retVal = true;
+                            break;
+                        }
+                }
             }
-            else if (_attribs[0] == (nint)spa_data_type.SPA_DATA_MemFd)
+            finally
             {
-                var fmt = Config.Instance.WaylandColorSwap
-                    ? GraphicsFormat.RGBA8
-                    : GraphicsFormat.BGRA8;
+                if (!keepLease)
+                    wlxpw_release(_handle, pb);
+            }
 
-                var len = (int)_attribs[2];
-                var off = (uint)_attribs[3];
-                var map = LibC.mmap(null, len, LibC.PROT_READ, LibC.MAP_SHARED, (int)_attribs[1], off);
+            if (error != EglEnum.Success)
+                throw new ApplicationException($"{error} on eglCreateImage!");
+        }
 
-                glTexture.Resize(_width, _height);
-                texture.LoadRawImage(new IntPtr(map), fmt, _width, _height);
+        LogLatency();
 
-                LibC.munmap(map, len);
-                retVal = true;
+        if (_cursorMetadata)
+            return ComposeCursor(overlayTexture, retVal);
+        return retVal;
+    }
+
+    /// <summary>
+    /// Frame counters and how long recent frames took from the compositor to the render thread.
+    /// </summary>
+    public wlxpw_latency GetLatency()
+    {
+        var latency = new wlxpw_latency();
+        if (_handle != IntPtr.Zero)
+            wlxpw_get_latency(_handle, ref latency);
+        return latency;
+    }
+
+    /// <summary>
+    /// Counters of the stream, for monitoring.
+    /// </summary>
+    public wlxpw_stats GetStats()
+    {
+        var stats = new wlxpw_stats();
+        if (_handle != IntPtr.Zero)
+            wlxpw_get_stats(_handle, ref stats);
+        return stats;
+    }
+
+    private unsafe void LogLatency()
+    {
+        var interval = Config.Instance.PipewireLatencyLog;
+        if (interval <= 0 || _nextLatencyLog > DateTime.UtcNow)
+            return;
+        _nextLatencyLog = DateTime.UtcNow.AddSeconds(interval);
+
+        var l = GetLatency();
+        var histogram = new uint[LatencyBuckets];
+        for (var i = 0; i < LatencyBuckets; i++)
+            histogram[i] = l.histogram[i];
+
+        Console.WriteLine($"PipeWire: {_name} {l.frames} frames, {l.frames_dropped} dropped, {l.seq_skipped} skipped, {l.out_of_buffers} out of buffers | "
+                          + $"produce->process {l.produce_to_process} | process->acquire {l.process_to_acquire} | "
+                          + $"produce->acquire {l.produce_to_acquire} | <2^i ms: {string.Join(" ", histogram)}");
+    }
+
+    /// <summary>
+    /// Redraw the overlay from the last frame and the cursor, if either of them changed.
+    /// </summary>
+    private bool ComposeCursor(GlTexture texture, bool frameChanged)
+    {
+        _hasFrame |= frameChanged;
+        var cursorChanged = UpdateCursorTexture();
+        if (!_hasFrame || (!frameChanged && !cursorChanged))
+            return false;
+
+        var capture = _captureTex!;
+        texture.Resize(capture.Width, capture.Height);
+
+        GraphicsEngine.Renderer.Begin(texture);
+        GraphicsEngine.Renderer.DrawSprite(capture, 0, capture.Height, capture.Width, -capture.Height);
+
+        if (_cursorVisible && _cursorTex != null)
+        {
+            // the capture may be downscaled by output_size
+            var scale = capture.Width / (float)_width;
+            var w = _cursorTex.GetWidth() * scale;
+            var h = _cursorTex.GetHeight() * scale;
+            var x = (_cursorPos.X - _cursorHot.X) * scale;
+            var y = (_cursorPos.Y - _cursorHot.Y) * scale;
+            GraphicsEngine.Renderer.DrawSprite(_cursorTex, x, y + h, w, -h);
+        }
+
+        GraphicsEngine.Renderer.End();
+        return true;
+    }
+
+    /// <returns>true if the cursor moved or changed since the last call</returns>
+    private bool UpdateCursorTexture()
+    {
+        lock (_cursorLock)
+        {
+            if (!_cursorChanged)
+                return false;
+            _cursorChanged = false;
+
+            if (_cursorPixels != null)
+            {
+                _cursorTex?.Dispose();
+                _cursorTex = GraphicsEngine.Instance.TextureFromRaw(_cursorWidth, _cursorHeight, _cursorFormat, _cursorPixels.AsSpan());
+                _cursorPixels = null;
             }
+            return true;
+        }
+    }
 
-            _attribs[0] = IntPtr.Zero;
+    /// <returns>true if the texture now holds the whole frame at full size</returns>
+    private unsafe bool LoadMapped(GlTexture texture, wlxpw_frame* pb, bool damageApplies)
+    {
+        var ptr = pb->data;
+        var stride = pb->strides[0];
+        var target = CaptureScale.TargetSize(_name, new Vector2Int((int)_width, (int)_height));
+        if (stride <= 0)
+            stride = (int)_width * 4;
+
+        if (target.X == _width && target.Y == _height)
+        {
+            var fmt = Config.Instance.WaylandColorSwap
+                ? GraphicsFormat.RGBA8
+                : GraphicsFormat.BGRA8;
+
+            if (texture.Width != _width || texture.Height != _height)
+            {
+                texture.Resize(_width, _height);
+                _diff.Reset();
+                damageApplies = false;
+            }
+
+            if (!damageApplies || pb->num_damage < 0)
+            {
+                _diff.ApplyToTexture(texture, ptr, fmt, (int)_width, (int)_height, stride);
+                return true;
+            }
+
+            // the tile hashes go stale while the compositor tells us what changed
+            _diff.Reset();
+            for (var i = 0; i < pb->num_damage; i++)
+                UploadRegion(texture, ptr, fmt, stride, pb->damage[i]);
+            return true;
         }
-        return retVal;
+
+        _diff.Reset();
+
+        var size = target.X * target.Y * 3;
+        if (_scaleBufSize < size)
+        {
+            Marshal.FreeHGlobal(_scaleBuf);
+            _scaleBuf = Marshal.AllocHGlobal(size);
+            _scaleBufSize = size;
+        }
+
+        // the scaler assumes BGRx input, so swapped input comes out as BGR
+        var scaledFmt = Config.Instance.WaylandColorSwap
+            ? GraphicsFormat.BGR8
+            : GraphicsFormat.RGB8;
+
+        // scaled straight into the upload ring when it is on
+        texture.Resize((uint)target.X, (uint)target.Y);
+        var dst = texture.ReserveSubImage(scaledFmt, target.X, target.Y, _scaleBuf);
+        wlxpw_scale(_handle, ptr, (int)_width, (int)_height, stride, dst, target.X, target.Y, target.X * 3, CaptureScale.FormatRGB);
+        texture.CommitSubImage(0, 0);
+        return false;
+    }
+
+    private void UploadRegion(GlTexture texture, IntPtr ptr, GraphicsFormat fmt, int stride, spa_region r)
+    {
+        var x0 = Math.Max(r.position.x, 0);
+        var y0 = Math.Max(r.position.y, 0);
+        var x1 = (int)Math.Min(r.position.x + r.size.width, _width);
+        var y1 = (int)Math.Min(r.position.y + r.size.height, _height);
+        if (x1 <= x0 || y1 <= y0)
+            return;
+
+        texture.LoadRawSubImage(ptr + y0 * stride + x0 * 4, fmt, x0, y0, x1 - x0, y1 - y0, stride / 4);
     }
 
     public unsafe void Initialize()
     {
         var fps = (uint)XrBackend.Current.DisplayFrequency;
 
-        _onFrameDelegate = OnFrame;
-        _onFrameHandle = Marshal.GetFunctionPointerForDelegate(_onFrameDelegate);
-        _handle = wlxpw_initialize(_name, _nodeId, fps, _dmaBufFormats, _onFrameHandle);
+        if (_cursorMetadata)
+        {
+            _onCursorDelegate = OnCursor;
+            _onCursorHandle = Marshal.GetFunctionPointerForDelegate(_onCursorDelegate);
+        }
+
+        if (_session == IntPtr.Zero)
+        {
+            _session = wlxpw_session_new("wlxoverlay-pw");
+            if (_session == IntPtr.Zero)
+            {
+                Console.WriteLine("ERR Could not connect to PipeWire!");
+                return;
+            }
+
+            if (Config.Instance.PipewireRtPriority > 0)
+                wlxpw_session_set_rt_priority(_session, Config.Instance.PipewireRtPriority);
+        }
+
+        _handle = wlxpw_session_add_stream(_session, _name, _nodeId, fps, _dmaBufFormats, IntPtr.Zero, _onCursorHandle);
+        if (_handle != IntPtr.Zero)
+            _numStreams++;
     }
 
     public void Pause()
@@ -196,82 +480,227 @@ public class PipeWireCapture : IDesktopCapture
             wlxpw_set_active(_handle, 1U);
     }
 
-    private unsafe void OnFrame(spa_buffer* pb, spa_video_info* info)
+    /// <summary>
+    /// Ask the compositor for smaller or less frequent frames. Only a hint,
+    /// the size of the frames that arrive is what gets used.
+    /// </summary>
+    public void RequestFormat(Vector2Int size, uint fps)
     {
-        lock (_attribsLock)
-        {
-            _width = info->raw.size.width;
-            _height = info->raw.size.height;
+        if (_handle == IntPtr.Zero || (size == _requestedSize && fps == _requestedFps))
+            return;
 
-            switch (pb->datas[0].type)
-            {
-                case spa_data_type.SPA_DATA_DmaBuf:
-                    {
-                        var planes = pb->n_datas;
+        if (wlxpw_request_format(_handle, (uint)size.X, (uint)size.Y, fps) < 0)
+            return;
 
-                        var format = FromSpaFormats[info->raw.format];
+        Console.WriteLine($"PipeWire: {_name} requesting {size.X}x{size.Y}@{fps}");
+        _requestedSize = size;
+        _requestedFps = fps;
+    }
 
-                        var i = 0;
-                        _attribs[i++] = (nint)EglEnum.Width;
-                        _attribs[i++] = (nint)_width;
-                        _attribs[i++] = (nint)EglEnum.Height;
-                        _attribs[i++] = (nint)_height;
-                        _attribs[i++] = (nint)EglEnum.LinuxDrmFourccExt;
-                        _attribs[i++] = (int)format;
+    private unsafe void BuildDmaBufAttribs(wlxpw_frame* pb)
+    {
+        var planes = pb->num_planes;
 
-                        for (var p = 0U; p < planes; p++)
-                        {
-                            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 0];
-                            _attribs[i++] = (nint)pb->datas[p].fd;
-                            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 1];
-                            _attribs[i++] = (nint)pb->datas[p].chunk->offset;
-                            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 2];
-                            _attribs[i++] = pb->datas[p].chunk->stride;
-                            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 3];
-                            _attribs[i++] = (nint)(info->raw.modifier & 0xFFFFFFFF);
-                            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 4];
-                            _attribs[i++] = (nint)(info->raw.modifier >> 32);
-                        }
+        var format = FromSpaFormats[(int)pb->format];
+
+        var i = 0;
+        _attribs[i++] = (nint)EglEnum.Width;
+        _attribs[i++] = (nint)_width;
+        _attribs[i++] = (nint)EglEnum.Height;
+        _attribs[i++] = (nint)_height;
+        _attribs[i++] = (nint)EglEnum.LinuxDrmFourccExt;
+        _attribs[i++] = (int)format;
 
-                        _attribs[i] = (nint)EglEnum.None;
-                        break;
-                    }
-                case spa_data_type.SPA_DATA_MemFd:
-                    {
-                        _attribs[0] = (nint)spa_data_type.SPA_DATA_MemFd;
-                        _attribs[1] = (nint)pb->datas[0].fd;
-                        _attribs[2] = (nint)pb->datas[0].chunk->size;
-                        _attribs[3] = (nint)pb->datas[0].chunk->offset;
-                        break;
-                    }
-                case spa_data_type.SPA_DATA_MemPtr:
-                    {
-                        _attribs[0] = (nint)spa_data_type.SPA_DATA_MemPtr;
-                        _attribs[1] = pb->datas[0].data;
-                        break;
-                    }
+        for (var p = 0; p < planes; p++)
+        {
+            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 0];
+            _attribs[i++] = pb->fds[p];
+            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 1];
+            _attribs[i++] = (nint)pb->offsets[p];
+            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 2];
+            _attribs[i++] = pb->strides[p];
+            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 3];
+            _attribs[i++] = (nint)(pb->modifier & 0xFFFFFFFF);
+            _attribs[i++] = (nint)EGL.DmaBufAttribs[p, 4];
+            _attribs[i++] = (nint)(pb->modifier >> 32);
+        }
+
+        _attribs[i] = (nint)EglEnum.None;
+    }
+
+    private unsafe void OnCursor(wlxpw_cursor* cursor)
+    {
+        lock (_cursorLock)
+        {
+            _cursorVisible = cursor->visible != 0;
+            _cursorPos = new Vector2Int(cursor->x, cursor->y);
+            _cursorHot = new Vector2Int(cursor->hotspot_x, cursor->hotspot_y);
+
+            if (cursor->serial != _cursorSerial && cursor->pixels != IntPtr.Zero
+                && SpaCursorFormats.TryGetValue(cursor->format, out var format))
+            {
+                _cursorSerial = cursor->serial;
+                _cursorWidth = (uint)cursor->width;
+                _cursorHeight = (uint)cursor->height;
+                _cursorFormat = format;
+                _cursorPixels = new byte[cursor->width * cursor->height * 4];
+                Marshal.Copy(cursor->pixels, _cursorPixels, 0, _cursorPixels.Length);
             }
+
+            _cursorChanged = true;
         }
     }
 
-    public void Dispose()
+    public unsafe void Dispose()
     {
-        wlxpw_destroy(_handle);
+        if (_handle != IntPtr.Zero)
+        {
+            // frames still leased are freed with the stream
+            wlxpw_destroy(_handle);
+            _handle = IntPtr.Zero;
+            _lease = null;
+            _lastLease = null;
+
+            if (--_numStreams == 0)
+            {
+                wlxpw_session_destroy(_session);
+                _session = IntPtr.Zero;
+            }
+        }
+
+        Marshal.FreeHGlobal(_scaleBuf);
+        _diff.Dispose();
+        _images.Dispose();
+        _captureTex?.Dispose();
+        _cursorTex?.Dispose();
     }
 
     [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
     private static extern IntPtr pw_get_library_version();
 
     [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
-    private static extern nint wlxpw_initialize(string name, uint nodeId, uint fps, IntPtr captureFormats, IntPtr onFrame);
+    private static extern nint wlxpw_session_new(string name);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern int wlxpw_session_set_rt_priority(nint session, int priority);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxpw_session_destroy(nint session);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern nint wlxpw_session_add_stream(nint session, string name, uint nodeId, uint fps, IntPtr captureFormats, IntPtr onFrame, IntPtr onCursor);
 
     [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
     private static extern void wlxpw_set_active(nint handle, uint active);
 
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern int wlxpw_request_format(nint handle, uint width, uint height, uint fps);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern unsafe wlxpw_frame* wlxpw_acquire_latest(nint handle);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern unsafe void wlxpw_release(nint handle, wlxpw_frame* frame);
+
     [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
     private static extern void wlxpw_destroy(nint handle);
 
-    private unsafe delegate void OnFrameDelegate(spa_buffer* pb, spa_video_info* info);
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxpw_scale(nint handle, IntPtr src, int srcW, int srcH, int srcStride,
+        IntPtr dst, int dstW, int dstH, int dstStride, int format);
+
+    private unsafe delegate void OnCursorDelegate(wlxpw_cursor* cursor);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxpw_get_latency(nint handle, ref wlxpw_latency latency);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxpw_get_stats(nint handle, ref wlxpw_stats stats);
+
+    [DllImport("libwlxpw.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxpw_set_log(IntPtr log);
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct wlxpw_stats
+    {
+        public ulong frames_received;
+        public ulong frames_delivered;
+        public ulong frames_drained;
+        public ulong frames_dropped;
+        public ulong frames_acquired;
+        public ulong out_of_buffers;
+        public ulong seq_skipped;
+        public ulong bytes;
+        public ulong renegotiations;
+    }
+
+    private const int LatencyBuckets = 10;
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct wlxpw_latency_stage
+    {
+        public uint samples;
+        public float p50_ms;
+        public float p95_ms;
+        public float p99_ms;
+        public float max_ms;
+
+        public override string ToString()
+        {
+            return samples == 0
+                ? "n/a"
+                : $"p50 {p50_ms:F1} p95 {p95_ms:F1} p99 {p99_ms:F1} max {max_ms:F1} ms";
+        }
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public unsafe struct wlxpw_latency
+    {
+        public ulong frames;
+        public ulong frames_dropped;
+        public ulong seq_skipped;
+        public ulong out_of_buffers;
+        public wlxpw_latency_stage produce_to_process;
+        public wlxpw_latency_stage process_to_acquire;
+        public wlxpw_latency_stage produce_to_acquire;
+        public fixed uint histogram[LatencyBuckets];
+    }
+
+    private const int MaxPlanes = 4;
+
+    [StructLayout(LayoutKind.Sequential)]
+    private unsafe struct wlxpw_frame
+    {
+        public spa_data_type type;
+        public uint format;
+        public ulong modifier;
+        public uint width;
+        public uint height;
+        public int num_planes;
+        public fixed int fds[MaxPlanes];
+        public fixed uint offsets[MaxPlanes];
+        public fixed int strides[MaxPlanes];
+        public IntPtr data;
+        public int num_damage;
+        public spa_region* damage;
+        public int removed;
+        public uint buffers_generation;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    private struct wlxpw_cursor
+    {
+        public int visible;
+        public int x;
+        public int y;
+        public int hotspot_x;
+        public int hotspot_y;
+        public uint serial;
+        public uint format;
+        public int width;
+        public int height;
+        public IntPtr pixels;
+    }
 
     private unsafe struct format_collection
     {
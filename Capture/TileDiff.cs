@@ -0,0 +1,102 @@
+using WlxOverlay.GFX;
+
+namespace WlxOverlay.Capture;
+
+/// <summary>
+/// Uploads only the tiles of a CPU frame that changed since the last one, for captures without damage information.
+/// </summary>
+public sealed class TileDiff : IDisposable
+{
+    // after this many frames in a row that changed completely, stop hashing for a while
+    private const int FullFramesBeforeBackoff = 8;
+    private const int BackoffFrames = 30;
+
+    private IntPtr _handle;
+    private int _fullStreak;
+    private int _backoff;
+
+    public TileDiff()
+    {
+        try
+        {
+            _handle = wlxdiff_create(0);
+        }
+        catch (DllNotFoundException)
+        {
+            Console.WriteLine("libwlxdiff.so not found, uploading whole frames.");
+        }
+    }
+
+    /// <summary>
+    /// Upload the changed parts of a 32bpp frame. The texture must hold the previous frame.
+    /// </summary>
+    /// <returns>false if nothing changed</returns>
+    public unsafe bool ApplyToTexture(ITexture texture, IntPtr ptr, GraphicsFormat format, int width, int height, int stride)
+    {
+        if (_handle == IntPtr.Zero || _backoff > 0)
+        {
+            if (_backoff > 0)
+                _backoff--;
+            texture.LoadRawSubImage(ptr, format, 0, 0, width, height, stride / 4);
+            return true;
+        }
+
+        var numRects = wlxdiff_update(_handle, ptr, width, height, stride, out var rects);
+        for (var i = 0; i < numRects; i++)
+        {
+            var r = rects[i];
+            texture.LoadRawSubImage(ptr + r.y * stride + r.x * 4, format, r.x, r.y, r.w, r.h, stride / 4);
+        }
+
+        if (numRects == 1 && rects[0].w == width && rects[0].h == height)
+        {
+            if (++_fullStreak >= FullFramesBeforeBackoff)
+            {
+                _fullStreak = 0;
+                _backoff = BackoffFrames;
+                wlxdiff_reset(_handle);
+            }
+        }
+        else
+            _fullStreak = 0;
+
+        return numRects > 0;
+    }
+
+    /// <summary>
+    /// Call when the texture was written by something else, so the next frame is uploaded whole.
+    /// </summary>
+    public void Reset()
+    {
+        if (_handle != IntPtr.Zero)
+            wlxdiff_reset(_handle);
+    }
+
+    public void Dispose()
+    {
+        if (_handle != IntPtr.Zero)
+            wlxdiff_destroy(_handle);
+        _handle = IntPtr.Zero;
+    }
+
+    [DllImport("libwlxdiff.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern IntPtr wlxdiff_create(int tileSize);
+
+    [DllImport("libwlxdiff.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxdiff_destroy(IntPtr handle);
+
+    [DllImport("libwlxdiff.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxdiff_reset(IntPtr handle);
+
+    [DllImport("libwlxdiff.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern unsafe int wlxdiff_update(IntPtr handle, IntPtr pixels, int width, int height, int stride, out rect_t* rects);
+
+    [StructLayout(LayoutKind.Sequential)]
+    private struct rect_t
+    {
+        public int x;
+        public int y;
+        public int w;
+        public int h;
+    }
+}
@@ -12,6 +12,7 @@ internal class DmaBufFrame : IWlrFrame
     private static readonly ArrayPool<int> IntPool = ArrayPool<int>.Shared;
 
     private readonly ZwlrExportDmabufFrameV1 _frame;
+    private readonly WlrCaptureData _data;
 
     private uint _width;
     private uint _height;
@@ -25,10 +26,10 @@ internal class DmaBufFrame : IWlrFrame
     private uint[]? _pitches;
 
     private CaptureStatus _status;
-    private IntPtr _eglImage;
 
     public DmaBufFrame(WlrCaptureData data)
     {
+        _data = data;
         _frame = data.DmabufManager!.CaptureOutput(1, data.Output!);
         _frame.Frame += OnFrame;
         _frame.Object += OnObject;
@@ -42,6 +43,18 @@ internal class DmaBufFrame : IWlrFrame
     {
         if (texture is not GlTexture glTexture) return;
 
+        // images of the old buffers would never be hit again
+        var modifier = (ulong)_modHi << 32 | _modLo;
+        if (_width != _data.ImagesWidth || _height != _data.ImagesHeight
+            || _format != _data.ImagesFormat || modifier != _data.ImagesModifier)
+        {
+            _data.Images.Clear();
+            _data.ImagesWidth = _width;
+            _data.ImagesHeight = _height;
+            _data.ImagesFormat = _format;
+            _data.ImagesModifier = modifier;
+        }
+
         var pool = ArrayPool<IntPtr>.Shared;
         var attribs = pool.Rent(7 + (int)_numObjects * 10);
         var i = 0;
@@ -69,14 +82,13 @@ internal class DmaBufFrame : IWlrFrame
 
         attribs[i] = (IntPtr)EglEnum.None;
 
-        _eglImage = EGL.CreateImage(EGL.Display, IntPtr.Zero, EglEnum.LinuxDmaBufExt, IntPtr.Zero, attribs);
-        var error = EGL.GetError();
-        if (error != EglEnum.Success)
-            throw new ApplicationException($"{error} on eglCreateImage!");
-
+        // the compositor sends the same few buffers over and over, with fresh fds each time
+        var image = _data.Images.GetOrCreate(attribs, out var error);
         pool.Return(attribs);
+        if (image == IntPtr.Zero)
+            throw new ApplicationException($"{error} on eglCreateImage!");
 
-        glTexture.LoadEglImage(_eglImage, _width, _height);
+        glTexture.LoadEglImage(image, _width, _height);
     }
 
     private void OnReady(object? _, ZwlrExportDmabufFrameV1.ReadyEventArgs e)
@@ -129,8 +141,6 @@ internal class DmaBufFrame : IWlrFrame
         if (_offsets != null)
             UintPool.Return(_offsets);
 
-        if (_eglImage != IntPtr.Zero)
-            EGL.DestroyImage(EGL.Display, _eglImage);
         _frame.Dispose();
     }
 }
@@ -1,54 +1,88 @@
-using Tmds.Linux;
 using WaylandSharp;
 using WlxOverlay.GFX;
 using WlxOverlay.Types;
-using static Tmds.Linux.LibC;
 
 namespace WlxOverlay.Capture.Wlr
 {
     internal class ScreenCopyFrame : IWlrFrame
 
     {
-        private readonly WlShm _shm;
+        // past this many damage boxes, the frame is uploaded as if there was no damage info
+        private const int MaxDamage = 16;
+
+        private readonly ShmBufferPool _buffers;
+        private readonly TileDiff _diff;
         private readonly ZwlrScreencopyFrameV1 _frame;
-        private readonly string _shmPath;
+        private readonly bool _withDamage;
 
         private uint _width;
         private uint _height;
-        private uint _size;
-        private int _fd;
-        private WlShmPool? _pool;
-        private WlBuffer? _buffer;
+        private uint _stride;
+        private ShmBuffer? _buffer;
+
+        private readonly (int x, int y, int w, int h)[] _damage = new (int, int, int, int)[MaxDamage];
+        private int _numDamage;
 
+        private bool _applied;
         private bool _disposed;
 
         private CaptureStatus _status;
 
         public ScreenCopyFrame(WlrCaptureData data)
         {
-            _shmPath = $"/wlxoverlay-screencopy-{data.Output!.GetId()}";
+            _buffers = data.Buffers ??= new ShmBufferPool(data.Shm!, $"/wlxoverlay-screencopy-{data.Output!.GetId()}");
+
+            // damage is reported from version 2 on, and copy_with_damage waits until there is some
+            _withDamage = data.ScreencopyManager!.GetVersion() >= 2;
+
             _frame = data.ScreencopyManager!.CaptureOutput(1, data.Output!);
             _frame.Buffer += OnBuffer;
             _frame.Ready += OnReady;
             _frame.Failed += OnFailed;
-            _shm = data.Shm!;
+            if (_withDamage)
+                _frame.Damage += OnDamage;
+            _diff = data.Diff;
         }
 
         public CaptureStatus GetStatus() => _status;
 
-        public unsafe void ApplyToTexture(ITexture texture)
+        public void ApplyToTexture(ITexture texture)
         {
-            var ptr = mmap((void*)0, _size, 0x01, 0x01, _fd, 0);
             var fmt = Config.Instance.WaylandColorSwap
                 ? GraphicsFormat.RGBA8
                 : GraphicsFormat.BGRA8;
 
-            texture.LoadRawImage(new IntPtr(ptr), fmt, _width, _height);
-            munmap(ptr, _size);
+            _applied = true;
+
+            lock (_buffers)
+            {
+                // reallocated for a newer frame, which will be uploaded whole
+                if (_buffer == null || _buffer.Value.Generation != _buffers.Generation)
+                    return;
+
+                var ptr = _buffer.Value.Ptr;
+
+                if (!_withDamage || _buffers.Stale || _numDamage < 0)
+                {
+                    _buffers.Stale = false;
+                    _diff.ApplyToTexture(texture, ptr, fmt, (int)_width, (int)_height, (int)_stride);
+                    return;
+                }
+
+                // the tile hashes go stale while the compositor tells us what changed
+                _diff.Reset();
+                for (var i = 0; i < _numDamage; i++)
+                {
+                    var (x, y, w, h) = _damage[i];
+                    texture.LoadRawSubImage(ptr + y * (int)_stride + x * 4, fmt, x, y, w, h, (int)_stride / 4);
+                }
+            }
         }
 
         private void OnFailed(object? sender, ZwlrScreencopyFrameV1.FailedEventArgs e)
         {
+            // a failed copy_with_damage still used up the damage since the last copy
+            _buffers.Stale = true;
             _status = CaptureStatus.FrameSkipped;
         }
 
@@ -57,19 +91,45 @@ namespace WlxOverlay.Capture.Wlr
             _status = CaptureStatus.FrameReady;
         }
 
+        private void OnDamage(object? sender, ZwlrScreencopyFrameV1.DamageEventArgs e)
+        {
+            if (_numDamage < 0)
+                return;
+
+            var x0 = (int)Math.Min(e.X, _width);
+            var y0 = (int)Math.Min(e.Y, _height);
+            var x1 = (int)Math.Min(e.X + e.Width, _width);
+            var y1 = (int)Math.Min(e.Y + e.Height, _height);
+            if (x1 <= x0 || y1 <= y0)
+                return;
+
+            if (_numDamage == MaxDamage)
+            {
+                _numDamage = -1;
+                return;
+            }
+
+            _damage[_numDamage++] = (x0, y0, x1 - x0, y1 - y0);
+        }
+
         private void OnBuffer(object? sender, ZwlrScreencopyFrameV1.BufferEventArgs e)
         {
+            if (!_buffers.TryAcquire(e.Format, e.Width, e.Height, e.Stride, out var buffer))
+            {
+                _status = CaptureStatus.Fatal;
+                return;
+            }
+
+            _buffer = buffer;
+
             _width = e.Width;
             _height = e.Height;
-            _size = e.Stride * e.Height;
+            _stride = e.Stride;
 
-            _fd = shm_open(_shmPath, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-            shm_unlink(_shmPath);
-            ftruncate(_fd, _size);
-
-            _pool = _shm.CreatePool(_fd, (int)_size);
-            _buffer = _pool.CreateBuffer(0, (int)e.Width, (int)e.Height, (int)e.Stride, e.Format);
-            _frame.Copy(_buffer!);
+            if (_withDamage)
+                _frame.CopyWithDamage(buffer.Buffer);
+            else
+                _frame.Copy(buffer.Buffer);
         }
 
         public void Dispose()
@@ -77,17 +137,15 @@ namespace WlxOverlay.Capture.Wlr
             if (_disposed)
                 return;
 
-            _buffer?.Destroy();
-            _pool?.Destroy();
-            if (_fd != 0) close(_fd);
+            // the damage of a frame that never reached the texture is lost with it
+            if (_status == CaptureStatus.FrameReady && !_applied)
+                _buffers.Stale = true;
+
+            if (_buffer != null)
+                _buffers.Release(_buffer.Value);
+
             _frame.Dispose();
             _disposed = true;
         }
-
-        [DllImport("libc")]
-        private static extern int shm_open([MarshalAs(UnmanagedType.LPStr)] string name, int oFlags, mode_t mode);
-
-        [DllImport("libc")]
-        private static extern int shm_unlink([MarshalAs(UnmanagedType.LPStr)] string name);
     }
 }
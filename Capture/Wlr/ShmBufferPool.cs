@@ -0,0 +1,167 @@
+using Tmds.Linux;
+using WaylandSharp;
+using static Tmds.Linux.LibC;
+
+namespace WlxOverlay.Capture.Wlr;
+
+internal readonly record struct ShmBuffer(int Index, int Generation, WlBuffer Buffer, IntPtr Ptr);
+
+/// <summary>
+/// A few screencopy buffers in one shm file that stays mapped for as long as the output is captured.
+/// The file is only reallocated when the compositor asks for a different size or format.
+/// </summary>
+internal sealed class ShmBufferPool : IDisposable
+{
+    // one being copied into, one waiting to be uploaded, one being uploaded
+    private const int NumBuffers = 3;
+
+    private readonly WlShm _shm;
+    private readonly string _shmPath;
+
+    private readonly WlBuffer?[] _buffers = new WlBuffer?[NumBuffers];
+    private readonly bool[] _busy = new bool[NumBuffers];
+    private WlShmPool? _pool;
+    private int _fd = -1;
+    private IntPtr _map;
+    private uint _mapSize;
+    private int _next;
+
+    private WlShmFormat _format;
+    private uint _width;
+    private uint _height;
+    private uint _stride;
+
+    /// <summary>
+    /// Set when the buffers were reallocated or a frame was dropped, so the damage reported
+    /// for the next frame does not cover everything that changed since the texture was last written.
+    /// </summary>
+    public bool Stale { get; set; } = true;
+
+    public ShmBufferPool(WlShm shm, string shmPath)
+    {
+        _shm = shm;
+        _shmPath = shmPath;
+    }
+
+    /// <summary>
+    /// Changes whenever the buffers are reallocated. Buffers of an older generation must not be read.
+    /// </summary>
+    public int Generation { get; private set; }
+
+    /// <summary>
+    /// Get a free buffer for a frame with the given layout, reallocating all of them if the layout changed.
+    /// Frames are captured on the dispatch thread and uploaded on the render thread,
+    /// so reading a buffer and reallocating happen while holding the pool's lock.
+    /// </summary>
+    /// <returns>false if the buffers could not be allocated or all of them are in use</returns>
+    public bool TryAcquire(WlShmFormat format, uint width, uint height, uint stride, out ShmBuffer buffer)
+    {
+        buffer = default;
+
+        lock (this)
+        {
+            if (_pool == null || format != _format || width != _width || height != _height || stride != _stride)
+            {
+                Free();
+                if (!Allocate(format, width, height, stride))
+                    return false;
+            }
+
+            for (var n = 0; n < NumBuffers; n++)
+            {
+                var i = (_next + n) % NumBuffers;
+                if (_busy[i])
+                    continue;
+
+                _busy[i] = true;
+                _next = (i + 1) % NumBuffers;
+                buffer = new ShmBuffer(i, Generation, _buffers[i]!, _map + (int)(i * _stride * _height));
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /// <summary>
+    /// Give back a buffer once its frame was uploaded or dropped.
+    /// </summary>
+    public void Release(ShmBuffer buffer)
+    {
+        lock (this)
+        {
+            if (buffer.Generation == Generation)
+                _busy[buffer.Index] = false;
+        }
+    }
+
+    private unsafe bool Allocate(WlShmFormat format, uint width, uint height, uint stride)
+    {
+        var size = stride * height;
+        _mapSize = size * NumBuffers;
+
+        _fd = shm_open(_shmPath, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+        shm_unlink(_shmPath);
+        if (_fd < 0 || ftruncate(_fd, _mapSize) < 0)
+        {
+            Console.WriteLine($"ERR Could not allocate {_mapSize} bytes of shm for screencopy.");
+            Free();
+            return false;
+        }
+
+        var ptr = mmap((void*)0, _mapSize, PROT_READ, MAP_SHARED, _fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            Console.WriteLine("ERR Could not map screencopy buffers.");
+            Free();
+            return false;
+        }
+        _map = new IntPtr(ptr);
+
+        _pool = _shm.CreatePool(_fd, (int)_mapSize);
+        for (var i = 0; i < NumBuffers; i++)
+            _buffers[i] = _pool.CreateBuffer((int)(i * size), (int)width, (int)height, (int)stride, format);
+
+        _format = format;
+        _width = width;
+        _height = height;
+        _stride = stride;
+        _next = 0;
+        Array.Clear(_busy);
+        Generation++;
+        Stale = true;
+        return true;
+    }
+
+    private unsafe void Free()
+    {
+        for (var i = 0; i < NumBuffers; i++)
+        {
+            _buffers[i]?.Destroy();
+            _buffers[i] = null;
+        }
+
+        _pool?.Destroy();
+        _pool = null;
+
+        if (_map != IntPtr.Zero)
+            munmap(_map.ToPointer(), _mapSize);
+        _map = IntPtr.Zero;
+
+        if (_fd >= 0)
+            close(_fd);
+        _fd = -1;
+    }
+
+    public void Dispose()
+    {
+        lock (this)
+            Free();
+    }
+
+    [DllImport("libc")]
+    private static extern int shm_open([MarshalAs(UnmanagedType.LPStr)] string name, int oFlags, mode_t mode);
+
+    [DllImport("libc")]
+    private static extern int shm_unlink([MarshalAs(UnmanagedType.LPStr)] string name);
+}
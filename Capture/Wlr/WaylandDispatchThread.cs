@@ -0,0 +1,139 @@
+using WaylandSharp;
+using static Tmds.Linux.LibC;
+
+namespace WlxOverlay.Capture.Wlr;
+
+/// <summary>
+/// Reads and dispatches the events of a Wayland connection on a thread of its own, sleeping in poll() until the
+/// compositor sends something or Wake() is called. Dispatched runs on that thread after every batch of events,
+/// which is where captures look at their frames and request new ones.
+/// </summary>
+internal sealed class WaylandDispatchThread : IDisposable
+{
+    private const short POLLIN = 0x001;
+    private const int EFD_NONBLOCK = 0x800;
+    private const int EFD_CLOEXEC = 0x80000;
+
+    private readonly WlDisplay _display;
+    private readonly Thread _thread;
+    private readonly int _wakeFd;
+    private volatile bool _running = true;
+    private bool _disposed;
+    private bool _closeOnExit;
+
+    public event Action? Dispatched;
+
+    public WaylandDispatchThread(WlDisplay display, string name)
+    {
+        _display = display;
+        _wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_wakeFd < 0)
+            throw new ApplicationException("Could not create eventfd for Wayland dispatch.");
+
+        _thread = new Thread(Run) { Name = name, IsBackground = true };
+    }
+
+    public bool IsCurrentThread => Thread.CurrentThread == _thread;
+
+    public void Start()
+    {
+        _thread.Start();
+    }
+
+    /// <summary>
+    /// Make the thread run Dispatched soon, even if no events arrive.
+    /// </summary>
+    public unsafe void Wake()
+    {
+        ulong one = 1;
+        write(_wakeFd, &one, (uint)sizeof(ulong));
+    }
+
+    private unsafe void Run()
+    {
+        var fds = stackalloc poll_fd[2];
+        fds[0].fd = _display.GetFd();
+        fds[1].fd = _wakeFd;
+
+        Dispatched?.Invoke();
+        _display.Flush();
+
+        while (_running)
+        {
+            while (_display.PrepareRead() != 0)
+                _display.DispatchPending();
+            _display.Flush();
+
+            fds[0].events = fds[1].events = POLLIN;
+            fds[0].revents = fds[1].revents = 0;
+
+            if (poll(fds, 2, -1) < 0)
+            {
+                _display.CancelRead();
+                continue;
+            }
+
+            if ((fds[0].revents & POLLIN) != 0)
+            {
+                if (_display.ReadEvents() < 0)
+                {
+                    Console.WriteLine("ERR Lost the Wayland connection of a capture.");
+                    _running = false;
+                }
+            }
+            else
+                _display.CancelRead();
+
+            if ((fds[1].revents & POLLIN) != 0)
+            {
+                ulong count;
+                read(_wakeFd, &count, (uint)sizeof(ulong));
+            }
+
+            _display.DispatchPending();
+            Dispatched?.Invoke();
+            _display.Flush();
+        }
+
+        // disposed from one of our own callbacks, nobody is going to join
+        if (_closeOnExit)
+            close(_wakeFd);
+    }
+
+    /// <summary>
+    /// Stop the thread and wait for it, unless called from the thread itself.
+    /// The connection is left open.
+    /// </summary>
+    public void Dispose()
+    {
+        if (_disposed)
+            return;
+        _disposed = true;
+        _running = false;
+
+        if (IsCurrentThread)
+        {
+            _closeOnExit = true;
+            return;
+        }
+
+        Wake();
+        if (_thread.IsAlive)
+            _thread.Join();
+        close(_wakeFd);
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    private struct poll_fd
+    {
+        public int fd;
+        public short events;
+        public short revents;
+    }
+
+    [DllImport("libc")]
+    private static extern unsafe int poll(poll_fd* fds, ulong nfds, int timeout);
+
+    [DllImport("libc")]
+    private static extern int eventfd(uint initval, int flags);
+}
@@ -0,0 +1,145 @@
+using WaylandSharp;
+using WlxOverlay.Core.Subsystem;
+
+namespace WlxOverlay.Capture.Wlr;
+
+/// <summary>
+/// The Wayland connection that all wlr captures share. The capture managers and outputs are bound once,
+/// and a single dispatch thread serves the frames of every output.
+/// </summary>
+public sealed class WlrConnection : IDisposable
+{
+    private readonly WlDisplay _display;
+    private readonly WlRegistry _registry;
+    private readonly WaylandDispatchThread _dispatch;
+
+    private readonly Dictionary<uint, WlOutput> _outputs = new();
+
+    // held while the captures look at their frames, so one can leave without racing the dispatch thread
+    private readonly object _capturesLock = new();
+    private readonly List<Action> _captures = new();
+
+    private bool _started;
+    private bool _disposed;
+
+    public WlShm? Shm { get; private set; }
+    public ZwlrExportDmabufManagerV1? DmabufManager { get; private set; }
+    public ZwlrScreencopyManagerV1? ScreencopyManager { get; private set; }
+
+    /// <summary>
+    /// Raised on the dispatch thread with the registry name of an output that went away.
+    /// </summary>
+    public event Action<uint>? OutputRemoved;
+
+    public WlrConnection()
+    {
+        _display = WlDisplay.Connect(WaylandSubsystem.DisplayName!);
+        _registry = _display.GetRegistry();
+
+        _registry.Global += (_, e) =>
+        {
+            if (e.Interface == WlInterface.WlOutput.Name)
+            {
+                lock (_outputs)
+                    _outputs[e.Name] = _registry.Bind<WlOutput>(e.Name, e.Interface, e.Version);
+            }
+            else if (e.Interface == WlInterface.WlShm.Name)
+                Shm = _registry.Bind<WlShm>(e.Name, e.Interface, e.Version);
+            else if (e.Interface == WlInterface.ZwlrExportDmabufManagerV1.Name)
+                DmabufManager = _registry.Bind<ZwlrExportDmabufManagerV1>(e.Name, e.Interface, e.Version);
+            else if (e.Interface == WlInterface.ZwlrScreencopyManagerV1.Name)
+                ScreencopyManager = _registry.Bind<ZwlrScreencopyManagerV1>(e.Name, e.Interface, e.Version);
+        };
+
+        _registry.GlobalRemove += (_, e) =>
+        {
+            WlOutput? output;
+            lock (_outputs)
+            {
+                if (!_outputs.Remove(e.Name, out output))
+                    return;
+            }
+
+            OutputRemoved?.Invoke(e.Name);
+            output.Dispose();
+        };
+
+        _display.Roundtrip();
+
+        _dispatch = new WaylandDispatchThread(_display, "Wayland capture");
+        _dispatch.Dispatched += OnDispatched;
+    }
+
+    public WlOutput? GetOutput(uint name)
+    {
+        lock (_outputs)
+            return _outputs.TryGetValue(name, out var output) ? output : null;
+    }
+
+    /// <summary>
+    /// Have onDispatched called on the dispatch thread after every batch of events,
+    /// starting the thread if this is the first capture.
+    /// </summary>
+    public void AddCapture(Action onDispatched)
+    {
+        lock (_capturesLock)
+        {
+            _captures.Add(onDispatched);
+            if (!_started)
+            {
+                _dispatch.Start();
+                _started = true;
+            }
+        }
+
+        _dispatch.Wake();
+    }
+
+    /// <summary>
+    /// Once this returns, onDispatched is not running and will not be called again.
+    /// </summary>
+    public void RemoveCapture(Action onDispatched)
+    {
+        lock (_capturesLock)
+            _captures.Remove(onDispatched);
+    }
+
+    /// <summary>
+    /// Make the dispatch thread look at the frames of all captures.
+    /// </summary>
+    public void Wake()
+    {
+        _dispatch.Wake();
+    }
+
+    private void OnDispatched()
+    {
+        lock (_capturesLock)
+        {
+            foreach (var capture in _captures)
+                capture();
+        }
+    }
+
+    public void Dispose()
+    {
+        if (_disposed)
+            return;
+        _disposed = true;
+
+        _dispatch.Dispose();
+
+        lock (_outputs)
+        {
+            foreach (var output in _outputs.Values)
+                output.Dispose();
+            _outputs.Clear();
+        }
+
+        DmabufManager?.Dispose();
+        ScreencopyManager?.Dispose();
+        Shm?.Dispose();
+        _registry.Dispose();
+        _display.Dispose();
+    }
+}
@@ -1,6 +1,5 @@
 using WaylandSharp;
 using WlxOverlay.Capture.Wlr;
-using WlxOverlay.Core.Subsystem;
 using WlxOverlay.Desktop.Wayland;
 using WlxOverlay.GFX;
 
@@ -8,48 +7,36 @@ namespace WlxOverlay.Capture;
 
 public class WlrCapture<T> : IDesktopCapture where T : IWlrFrame
 {
-    private readonly TimeSpan RoundTripSleepTime = TimeSpan.FromMilliseconds(1);
-
     private readonly WaylandOutput _screen;
-    private readonly WlDisplay _display;
+    private readonly WlrConnection _connection;
     private readonly WlrCaptureData _data;
 
-    private IWlrFrame? _frame;
-    private IWlrFrame? _lastFrame;
+    // owned by the dispatch thread
+    private IWlrFrame? _pending;
 
-    private readonly CancellationTokenSource _cancel = new();
-    private Task? _worker;
+    // the latest completed frame, waiting for the render thread
+    private readonly object _readyLock = new();
+    private IWlrFrame? _ready;
 
-    public WlrCapture(WaylandOutput output)
-    {
-        _display = WlDisplay.Connect(WaylandSubsystem.DisplayName!);
+    private volatile bool _paused;
+    private volatile bool _fatal;
+    private bool _started;
+    private bool _disposed;
 
-        var reg = _display.GetRegistry();
-        _data = new WlrCaptureData();
+    public WlrCapture(WlrConnection connection, WaylandOutput output)
+    {
+        _connection = connection;
         _screen = output;
 
-        reg.Global += (_, e) =>
-        {
-            if (e.Interface == WlInterface.WlOutput.Name)
-            {
-                if (e.Name == output.IdName)
-                    _data.Output = reg.Bind<WlOutput>(e.Name, e.Interface, e.Version);
-            }
-            else if (e.Interface == WlInterface.WlShm.Name)
-                _data.Shm = reg.Bind<WlShm>(e.Name, e.Interface, e.Version);
-            else if (e.Interface == WlInterface.ZwlrExportDmabufManagerV1.Name)
-                _data.DmabufManager = reg.Bind<ZwlrExportDmabufManagerV1>(e.Name, e.Interface, e.Version);
-            else if (e.Interface == WlInterface.ZwlrScreencopyManagerV1.Name)
-                _data.ScreencopyManager = reg.Bind<ZwlrScreencopyManagerV1>(e.Name, e.Interface, e.Version);
-        };
-
-        reg.GlobalRemove += (_, e) =>
+        _data = new WlrCaptureData
         {
-            if (e.Name == _data.Output!.GetId())
-                Dispose();
+            Output = connection.GetOutput(output.IdName),
+            Shm = connection.Shm,
+            DmabufManager = connection.DmabufManager,
+            ScreencopyManager = connection.ScreencopyManager,
         };
 
-        _display.Roundtrip();
+        _connection.OutputRemoved += OnOutputRemoved;
     }
 
     public void Initialize()
@@ -71,73 +58,127 @@ public class WlrCapture<T> : IDesktopCapture where T : IWlrFrame
             Console.WriteLine("FATAL Check your `config.yaml`!");
             throw new ApplicationException();
         }
+
+        _connection.AddCapture(OnDispatched);
+        _started = true;
     }
 
     public bool TryApplyToTexture(ITexture texture)
     {
-        var wantNewFrame = true;
-        var retVal = false;
+        if (_fatal)
+        {
+            Console.WriteLine($"{_screen.Name}: Fatal error occurred.");
+            Dispose();
+            return false;
+        }
 
-        if (_worker is { Status: TaskStatus.RanToCompletion })
+        IWlrFrame? frame;
+        lock (_readyLock)
         {
-            _worker.Dispose();
-            switch (_frame!.GetStatus())
-            {
-                case CaptureStatus.FrameReady:
-                    _frame.ApplyToTexture(texture);
-                    retVal = true;
-                    break;
-                case CaptureStatus.FrameSkipped:
-                    Console.WriteLine($"{_screen.Name}: Frame was skipped.");
-                    break;
-                case CaptureStatus.Fatal:
-                    Console.WriteLine($"{_screen.Name}: Fatal error occurred.");
-                    Dispose();
-                    return false;
-            }
+            frame = _ready;
+            _ready = null;
         }
-        else if (_worker != null)
-            wantNewFrame = false;
 
-        if (wantNewFrame)
-            _worker = Task.Run(RequestNewFrame, _cancel.Token);
-        return retVal;
+        if (frame == null)
+            return false;
+
+        // the slot is free again, so the next frame can be requested while this one is uploaded
+        _connection.Wake();
+
+        frame.ApplyToTexture(texture);
+        frame.Dispose();
+        return true;
     }
 
     public void Pause()
     {
-        _lastFrame?.Dispose();
-        _frame?.Dispose();
-        _lastFrame = null;
-        _frame = null;
-        _worker = null;
+        _paused = true;
+
+        lock (_readyLock)
+        {
+            _ready?.Dispose();
+            _ready = null;
+        }
     }
 
     public void Resume()
     {
+        _paused = false;
+        _connection.Wake();
     }
 
     public void Dispose()
     {
+        if (_disposed)
+            return;
+        _disposed = true;
+
+        _paused = true;
+        _connection.OutputRemoved -= OnOutputRemoved;
+        if (_started)
+            _connection.RemoveCapture(OnDispatched);
+
+        _pending?.Dispose();
+        _pending = null;
         Pause();
-        _display.Dispose();
+
         _data.Dispose();
     }
 
-    private void RequestNewFrame()
+    private void OnOutputRemoved(uint name)
+    {
+        if (name == _screen.IdName)
+            _fatal = true;
+    }
+
+    /// <summary>
+    /// Runs on the dispatch thread. Moves a completed frame into the ready slot and requests the next one,
+    /// keeping at most one frame in flight and one waiting, so that at most one is being uploaded besides them.
+    /// </summary>
+    private void OnDispatched()
     {
-        _lastFrame?.Dispose();
-        _lastFrame = _frame;
-        _frame = (IWlrFrame?)Activator.CreateInstance(typeof(T), _data);
-        _display.Roundtrip();
-        while (_frame?.GetStatus() == CaptureStatus.Pending)
+        if (_pending != null)
         {
-            Thread.Sleep(RoundTripSleepTime);
-            _display.Roundtrip();
+            switch (_pending.GetStatus())
+            {
+                case CaptureStatus.Pending:
+                    return;
+                case CaptureStatus.FrameReady when !_paused:
+                    lock (_readyLock)
+                    {
+                        _ready?.Dispose();
+                        _ready = _pending;
+                    }
+                    _pending = null;
+                    break;
+                case CaptureStatus.FrameSkipped:
+                    Console.WriteLine($"{_screen.Name}: Frame was skipped.");
+                    break;
+                case CaptureStatus.Fatal:
+                    _fatal = true;
+                    break;
+            }
+
+            _pending?.Dispose();
+            _pending = null;
+        }
+
+        if (_paused || _fatal)
+            return;
+
+        lock (_readyLock)
+        {
+            if (_ready != null)
+                return;
         }
+
+        _pending = (IWlrFrame?)Activator.CreateInstance(typeof(T), _data);
     }
 }
 
+/// <summary>
+/// What the frames of one output need. The output and the managers belong to the shared <see cref="WlrConnection"/>.
+/// </summary>
 public sealed class WlrCaptureData : IDisposable
 {
     public WlOutput? Output;
@@ -145,11 +186,25 @@ public sealed class WlrCaptureData : IDisposable
     public ZwlrScreencopyManagerV1? ScreencopyManager;
     public WlShm? Shm;
 
+    // screencopy frames come without damage, so changes are found by comparing them
+    public readonly TileDiff Diff = new();
+
+    // screencopy buffers of this output, kept across frames
+    internal ShmBufferPool? Buffers;
+
+    // export-dmabuf frames of this output, imported once per buffer
+    public readonly EglImageCache Images = new();
+
+    // what the cached images were made for, the compositor allocates new buffers when it changes
+    internal uint ImagesWidth;
+    internal uint ImagesHeight;
+    internal uint ImagesFormat;
+    internal ulong ImagesModifier;
+
     public void Dispose()
     {
-        Output!.Dispose();
-        DmabufManager?.Dispose();
-        ScreencopyManager?.Dispose();
-        Shm?.Dispose();
+        Buffers?.Dispose();
+        Diff.Dispose();
+        Images.Dispose();
     }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 using System.Diagnostics.CodeAnalysis;
 using WlxOverlay.Desktop;
 using WlxOverlay.GFX;
+using WlxOverlay.GFX.OpenGL;
 using WlxOverlay.Numerics;
 using WlxOverlay.Types;
 
@@ -8,35 +9,85 @@ namespace WlxOverlay.Capture;
 
 public class XshmCapture : IDesktopCapture
 {
+    private const int AllScreens = -1;
+
     private static ITexture? _mouseTex;
     private static Vector2Int _mousePos;
     private static bool _mousePosSet;
 
+    // native cursor image from XFixes, falls back to _mouseTex if unavailable
+    private static ITexture? _cursorTex;
+    private static Vector2Int _cursorHot;
+    private static uint _cursorSerial;
+
+    // A single capture of the bounding box of all screens, shared by all instances.
+    private static IntPtr _handle;
+    private static Vector2Int _origin;
+    private static int _numInstances;
+    private static int _numRunning;
+    private static unsafe buf_t* _frame;
+    private static bool _framePolled;
+
+    // bumped whenever randr reports a new screen layout
+    private static int _geometryVersion;
+
+    // damage alignment that suits the downscale factor of every screen
+    private static int _align = 1;
+
     public static int NumScreens()
     {
-        return wlxshm_num_screens();
+        return TryCreateHandle() ? wlxshm_screen_count(_handle) : 0;
+    }
+
+    private static bool TryCreateHandle()
+    {
+        if (_handle != IntPtr.Zero)
+            return true;
+
+        wlxshm_set_log(NativeLog.Handle);
+
+        Vector2Int size = new(), pos = new();
+        _handle = wlxshm_create(AllScreens, ref size, ref pos);
+        _origin = pos;
+
+        return _handle != IntPtr.Zero;
     }
 
     private readonly BaseOutput _screen;
-    private readonly IntPtr _handle;
-    private readonly uint _bufSize;
+    private Vector2Int _offset;
+    private int _lastGeometryVersion;
+
+    // integer downscale factor from output_size, and the buffer it is scaled into
+    private int _scale = 1;
+    private IntPtr _scaleBuf;
+    private int _scaleBufSize;
 
     private bool _running;
 
+    // desktop pixels without the cursor, composited into the overlay texture on change
+    private GlTexture? _captureTex;
+
+    private Vector2Int _lastMouse = new(-1, -1);
+    private uint _lastCursorSerial;
+    private bool _mouseVisible;
+
     public XshmCapture(BaseOutput output)
     {
+        if (!TryCreateHandle())
+            throw new ApplicationException("Could not initialize Xorg screen capture!");
+
         Vector2Int size = new(), pos = new();
 
-        _handle = wlxshm_create((int)output.IdName, ref size, ref pos);
+        wlxshm_screen_geo(_handle, (int)output.IdName, ref size, ref pos);
         output.Size = size;
         output.Position = pos;
         output.RecalculateTransform();
         _screen = output;
+        _offset = new Vector2Int(pos.X - _origin.X, pos.Y - _origin.Y);
+        _lastGeometryVersion = _geometryVersion;
+        UpdateScale();
 
-        if (_handle == IntPtr.Zero)
-            throw new ApplicationException("Could not initialize Xorg screen capture!");
-
-        _bufSize = (uint)(size.X * size.Y * 4U);
+        _numInstances++;
     }
 
     public void Initialize()
@@ -44,73 +95,285 @@ public class XshmCapture : IDesktopCapture
         _mouseTex ??= GraphicsEngine.Instance.TextureFromFile(
             Path.Combine(Config.ResourcesFolder, "arrow.png"));
 
-        wlxshm_capture_start(_handle);
-        _running = true;
+        Resume();
+    }
+
+    private static unsafe void UpdateCursor()
+    {
+        if (_mousePosSet)
+            return;
+        _mousePosSet = true;
+
+        wlxshm_mouse_pos_global(_handle, ref _mousePos);
+
+        var cursor = wlxshm_get_cursor(_handle);
+        if (cursor == null || cursor->pixels == IntPtr.Zero || cursor->width == 0)
+            return;
+
+        if (_cursorTex != null && cursor->serial == _cursorSerial)
+            return;
+
+        _cursorTex?.Dispose();
+        _cursorTex = GraphicsEngine.Instance.TextureFromRaw((uint)cursor->width, (uint)cursor->height,
+            GraphicsFormat.BGRA8, cursor->pixels);
+        _cursorHot = new Vector2Int(cursor->xhot, cursor->yhot);
+        _cursorSerial = cursor->serial;
+    }
+
+    private void UpdateScale()
+    {
+        _scale = CaptureScale.BoxFactor(_screen.Name, _screen.Size);
+
+        // rects are aligned from the capture origin, so the screen must start on a block boundary
+        if (_scale > 1 && (_offset.X % _scale != 0 || _offset.Y % _scale != 0))
+        {
+            Console.WriteLine($"{_screen.Name} is not aligned to its output_size, capturing at full size.");
+            _scale = 1;
+        }
+
+        if (_align % _scale != 0)
+        {
+            _align = _align * _scale / Gcd(_align, _scale);
+            wlxshm_set_align(_handle, _align);
+        }
+    }
+
+    private static int Gcd(int a, int b)
+    {
+        while (b != 0)
+            (a, b) = (b, a % b);
+        return a;
+    }
+
+    private Vector2Int ScaledSize => new(_screen.Size.X / _scale, _screen.Size.Y / _scale);
+
+    private void UpdateGeometry()
+    {
+        _lastGeometryVersion = _geometryVersion;
+
+        Vector2Int size = new(), pos = new();
+        if (wlxshm_screen_geo(_handle, (int)_screen.IdName, ref size, ref pos) < 0)
+            return; // screen is gone, keep showing the last known layout
+
+        var changed = size != _screen.Size || pos != _screen.Position;
+        if (changed)
+        {
+            Console.WriteLine($"{_screen.Name} is now {size.X}x{size.Y} at {pos.X},{pos.Y}");
+            _screen.Size = size;
+            _screen.Position = pos;
+            _screen.RecalculateTransform();
+        }
+
+        var scale = _scale;
+        _offset = new Vector2Int(pos.X - _origin.X, pos.Y - _origin.Y);
+        UpdateScale();
+
+        if (!changed && scale == _scale)
+            return;
+
+        _captureTex?.Dispose();
+        _captureTex = null;
+        _lastMouse = new Vector2Int(-1, -1);
     }
 
     public unsafe bool TryApplyToTexture(ITexture texture)
     {
-        var retVal = false;
-        var buf = wlxshm_capture_frame(_handle);
-        if (buf != null && buf->length == _bufSize)
+        if (_lastGeometryVersion != _geometryVersion)
+            UpdateGeometry();
+
+        UpdateCursor();
+
+        var scaled = ScaledSize;
+        if (_captureTex == null)
+        {
+            _captureTex = (GlTexture)GraphicsEngine.Instance.EmptyTexture((uint)scaled.X, (uint)scaled.Y,
+                internalFormat: GraphicsFormat.RGB8, dynamic: true);
+            (texture as GlTexture)?.Resize((uint)scaled.X, (uint)scaled.Y);
+        }
+
+        if (!_framePolled)
         {
-            texture.LoadRawImage(buf->buffer, GraphicsFormat.BGRA8);
-            retVal = true;
+            _frame = wlxshm_capture_poll(_handle);
+            _framePolled = true;
         }
 
-        if (!_mousePosSet)
+        var uploaded = false;
+        var buf = _frame;
+        if (buf != null && buf->length > 0)
         {
-            wlxshm_mouse_pos_global(_handle, ref _mousePos);
-            _mousePosSet = true;
+            for (var i = 0; i < buf->num_rects; i++)
+            {
+                var r = buf->rects[i];
+
+                // the part of the rect that lies on this screen
+                var x0 = Math.Max(r.x, _offset.X);
+                var y0 = Math.Max(r.y, _offset.Y);
+                var x1 = Math.Min(r.x + r.w, _offset.X + _screen.Size.X);
+                var y1 = Math.Min(r.y + r.h, _offset.Y + _screen.Size.Y);
+
+                if (x1 <= x0 || y1 <= y0)
+                    continue;
+
+                var ptr = buf->buffer + r.offset + ((y0 - r.y) * r.w + (x0 - r.x)) * 4;
+                if (_scale == 1)
+                {
+                    _captureTex.LoadRawSubImage(ptr, GraphicsFormat.BGRA8, x0 - _offset.X, y0 - _offset.Y, x1 - x0, y1 - y0, r.w);
+                    uploaded = true;
+                    continue;
+                }
+
+                // rects are aligned to the scale, only a clipped block at the screen edge is dropped
+                var dx = (x0 - _offset.X) / _scale;
+                var dy = (y0 - _offset.Y) / _scale;
+                var dw = (x1 - _offset.X) / _scale - dx;
+                var dh = (y1 - _offset.Y) / _scale - dy;
+                if (dw <= 0 || dh <= 0)
+                    continue;
+
+                // scaled straight into the upload ring when it is on
+                var dst = _captureTex.ReserveSubImage(GraphicsFormat.RGB8, dw, dh, GetScaleBuffer(dw * dh * 3));
+                wlxshm_scale(_handle, ptr, dw * _scale, dh * _scale, r.w * 4, dst, dw, dh, dw * 3, CaptureScale.FormatRGB);
+                _captureTex.CommitSubImage(dx, dy);
+                uploaded = true;
+            }
         }
 
         var mouse = new Vector2Int(_mousePos.X - _screen.Position.X, _mousePos.Y - _screen.Position.Y);
+        var mouseVisible = mouse.X >= 0 && mouse.X < _screen.Size.X && mouse.Y >= 0 && mouse.Y < _screen.Size.Y;
+        var cursorChanged = (mouseVisible || _mouseVisible)
+                            && (mouse != _lastMouse || _cursorSerial != _lastCursorSerial);
 
-        if (mouse.X >= 0 && mouse.X < _screen.Size.X && mouse.Y >= 0 && mouse.Y < _screen.Size.Y)
-        {
-            var w = _mouseTex!.GetWidth() * (_screen.Size.X / 4096f);
-            var h = _mouseTex.GetHeight() * (_screen.Size.X / 4096f);
-            var x = mouse.X - w * 0.5f;
-            var y = mouse.Y - h * 0.5f;
+        if (!uploaded && !cursorChanged)
+            return false;
+
+        _lastMouse = mouse;
+        _lastCursorSerial = _cursorSerial;
+        _mouseVisible = mouseVisible;
+
+        _captureTex.CopyTo(texture);
 
+        if (mouseVisible)
+        {
+            var scale = 1f / _scale;
             GraphicsEngine.Renderer.Begin(texture);
-            GraphicsEngine.Renderer.DrawSprite(_mouseTex, x, y, w, h);
+            if (_cursorTex != null)
+            {
+                // raw image is top-down, unlike textures loaded from file
+                var w = _cursorTex.GetWidth() * scale;
+                var h = _cursorTex.GetHeight() * scale;
+                var x = (mouse.X - _cursorHot.X) * scale;
+                var y = (mouse.Y - _cursorHot.Y) * scale;
+                GraphicsEngine.Renderer.DrawSprite(_cursorTex, x, y + h, w, -h);
+            }
+            else
+            {
+                var w = _mouseTex!.GetWidth() * (_screen.Size.X / 4096f) * scale;
+                var h = _mouseTex.GetHeight() * (_screen.Size.X / 4096f) * scale;
+                var x = mouse.X * scale - w * 0.5f;
+                var y = mouse.Y * scale - h * 0.5f;
+                GraphicsEngine.Renderer.DrawSprite(_mouseTex, x, y, w, h);
+            }
             GraphicsEngine.Renderer.End();
         }
-        return retVal;
+
+        return true;
+    }
+
+    private IntPtr GetScaleBuffer(int size)
+    {
+        if (_scaleBufSize < size)
+        {
+            Marshal.FreeHGlobal(_scaleBuf);
+            _scaleBuf = Marshal.AllocHGlobal(size);
+            _scaleBufSize = size;
+        }
+        return _scaleBuf;
     }
 
-    public static void ResetMouse()
+    /// <summary>
+    /// Call once per frame, after all screens have been rendered.
+    /// </summary>
+    public static void EndFrame()
     {
         _mousePosSet = false;
+        _framePolled = false;
+
+        // X server fills the back buffer while we render the next frame
+        if (_numRunning > 0 && wlxshm_capture_begin(_handle) > 0)
+        {
+            Vector2Int size = new(), pos = new();
+            wlxshm_capture_geo(_handle, ref size, ref pos);
+            _origin = pos;
+            _geometryVersion++;
+        }
     }
 
     public void Pause()
     {
         if (!_running)
             return;
-        wlxshm_capture_end(_handle);
         _running = false;
+
+        if (--_numRunning == 0)
+            wlxshm_capture_end(_handle);
     }
 
     public void Resume()
     {
-        wlxshm_capture_start(_handle);
+        if (_running)
+            return;
         _running = true;
+
+        if (_numRunning++ == 0)
+            wlxshm_capture_start(_handle);
+        else // the damage of this screen went to the others while it was hidden
+            wlxshm_add_damage(_handle, _offset.X, _offset.Y, _screen.Size.X, _screen.Size.Y);
+    }
+
+    /// <summary>
+    /// Counters of the shared capture, for monitoring.
+    /// </summary>
+    public static wlxshm_stats GetStats()
+    {
+        var stats = new wlxshm_stats();
+        if (_handle != IntPtr.Zero)
+            wlxshm_get_stats(_handle, ref stats);
+        return stats;
     }
 
     public void Dispose()
     {
         Pause();
+        _captureTex?.Dispose();
+        Marshal.FreeHGlobal(_scaleBuf);
+        _scaleBuf = IntPtr.Zero;
+
+        if (--_numInstances > 0)
+            return;
+
         wlxshm_destroy(_handle);
+        _handle = IntPtr.Zero;
+        _align = 1;
     }
 
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxshm_set_log(IntPtr log);
+
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxshm_get_stats(IntPtr handle, ref wlxshm_stats stats);
+
     [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
     private static extern IntPtr wlxshm_create(int screen, ref Vector2Int size, ref Vector2Int pos);
 
     [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
     private static extern void wlxshm_destroy(IntPtr handle);
 
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern int wlxshm_screen_count(IntPtr handle);
+
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern int wlxshm_screen_geo(IntPtr handle, int screen, ref Vector2Int size, ref Vector2Int pos);
+
     [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
     private static extern int wlxshm_capture_start(IntPtr handle);
 
@@ -118,19 +381,72 @@ public class XshmCapture : IDesktopCapture
     private static extern void wlxshm_capture_end(IntPtr handle);
 
     [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
-    private static extern unsafe buf_t* wlxshm_capture_frame(IntPtr handle);
+    private static extern int wlxshm_capture_begin(IntPtr handle);
 
     [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
-    private static extern void wlxshm_mouse_pos_global(IntPtr handle, ref Vector2Int pos);
+    private static extern unsafe buf_t* wlxshm_capture_poll(IntPtr handle);
+
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxshm_set_align(IntPtr handle, int align);
+
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxshm_add_damage(IntPtr handle, int x, int y, int w, int h);
+
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxshm_scale(IntPtr handle, IntPtr src, int srcW, int srcH, int srcStride,
+        IntPtr dst, int dstW, int dstH, int dstStride, int format);
+
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern void wlxshm_capture_geo(IntPtr handle, ref Vector2Int size, ref Vector2Int pos);
+
+    [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
+    private static extern unsafe cursor_t* wlxshm_get_cursor(IntPtr handle);
 
     [DllImport("libwlxshm.so", CallingConvention = CallingConvention.Cdecl)]
-    private static extern int wlxshm_num_screens();
+    private static extern void wlxshm_mouse_pos_global(IntPtr handle, ref Vector2Int pos);
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct wlxshm_stats
+    {
+        public ulong frames;
+        public ulong frames_failed;
+        public ulong bytes;
+        public ulong get_image_requests;
+        public ulong round_trips;
+        public ulong wait_ns;
+        public ulong reply_ns;
+        public ulong geometry_changes;
+    }
 
     [StructLayout(LayoutKind.Sequential)]
     [SuppressMessage("ReSharper", "FieldCanBeMadeReadOnly.Local")]
-    private struct buf_t
+    private unsafe struct buf_t
     {
         public int length;
         public IntPtr buffer;
+        public int num_rects;
+        public rect_t* rects;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    private struct rect_t
+    {
+        public int x;
+        public int y;
+        public int w;
+        public int h;
+        public int offset;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    [SuppressMessage("ReSharper", "FieldCanBeMadeReadOnly.Local")]
+    private struct cursor_t
+    {
+        public uint serial;
+        public int width;
+        public int height;
+        public int xhot;
+        public int yhot;
+        public IntPtr pixels;
     }
-}
\ No newline at end of file
+}
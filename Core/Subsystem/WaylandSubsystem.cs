@@ -19,6 +19,7 @@ public class WaylandSubsystem : ISubsystem
     private readonly List<CaptureMethod> _supportedCaptureMethods = new();
 
     private readonly WlDisplay _display;
+    private WlrConnection? _captureConnection;
     private ZxdgOutputManagerV1? _outputManager;
     private WlSeat? _seat;
     private CaptureMethod _captureMethod;
@@ -120,19 +121,21 @@ public class WaylandSubsystem : ISubsystem
         {
             case CaptureMethod.WlrDmaBuf:
                 Console.WriteLine($"Using desktop capture protocol: {WlInterface.ZwlrExportDmabufManagerV1.Name}");
+                _captureConnection = new WlrConnection();
                 foreach (var output in _outputs.Values)
                 {
                     var screen = new DesktopOverlay(output,
-                        new WlrCapture<DmaBufFrame>(output));
+                        new WlrCapture<DmaBufFrame>(_captureConnection, output));
                     OverlayRegistry.Register(screen);
                 }
                 break;
             case CaptureMethod.WlrScreenCopy:
                 Console.WriteLine($"Using desktop capture protocol: {WlInterface.ZwlrScreencopyManagerV1.Name}");
+                _captureConnection = new WlrConnection();
                 foreach (var output in _outputs.Values)
                 {
                     var screen = new DesktopOverlay(output,
-                        new WlrCapture<ScreenCopyFrame>(output));
+                        new WlrCapture<ScreenCopyFrame>(_captureConnection, output));
                     OverlayRegistry.Register(screen);
                 }
                 break;
@@ -162,9 +165,9 @@ public class WaylandSubsystem : ISubsystem
                 var data = await XdgScreenCastHandler.PromptUserAsync(output);
                 if (data != null)
                 {
-                    var screen = new DesktopOverlay(output, new PipeWireCapture(output, data.Value));
+                    var screen = new DesktopOverlay(output, new PipeWireCapture(output, data.Value.NodeId, data.Value.CursorMetadata));
                     OverlayRegistry.Register(screen);
-                    Console.WriteLine($"{output.Name} -> {data.Value}");
+                    Console.WriteLine($"{output.Name} -> {data.Value.NodeId}");
                 }
                 else
                     Console.WriteLine($"{output.Name} will not be used.");
@@ -181,9 +184,9 @@ public class WaylandSubsystem : ISubsystem
             if (data != null)
             {
                 output.RecalculateTransform();
-                var screen = new DesktopOverlay(output, new PipeWireCapture(output, data.Value));
+                var screen = new DesktopOverlay(output, new PipeWireCapture(output, data.Value.NodeId, data.Value.CursorMetadata));
                 OverlayRegistry.Register(screen);
-                Console.WriteLine($"{output.Name} -> {data.Value}");
+                Console.WriteLine($"{output.Name} -> {data.Value.NodeId}");
 
             }
             else
@@ -250,6 +253,7 @@ public class WaylandSubsystem : ISubsystem
         foreach (var output in _outputs.Values)
             output.Dispose();
 
+        _captureConnection?.Dispose();
         _seat?.Dispose();
         _outputManager?.Dispose();
         _display.Dispose();
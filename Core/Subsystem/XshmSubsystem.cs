@@ -21,7 +21,8 @@ public class XshmSubsystem : ISubsystem
     public void CreateScreens()
     {
         Console.WriteLine("X11 desktop detected.");
-        for (var s = 0; s < XshmCapture.NumScreens(); s++)
+        var numScreens = XshmCapture.NumScreens();
+        for (var s = 0; s < numScreens; s++)
         {
             var output = new BaseOutput(s);
             var screen = new DesktopOverlay(output, new XshmCapture(output));
@@ -35,7 +36,7 @@ public class XshmSubsystem : ISubsystem
 
     public void Update()
     {
-        XshmCapture.ResetMouse();
+        XshmCapture.EndFrame();
     }
 
     public void Dispose()
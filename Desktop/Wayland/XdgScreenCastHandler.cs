@@ -6,20 +6,27 @@ using WlxOverlay.Types;
 
 namespace WlxOverlay.Desktop.Wayland;
 
+/// <param name="CursorMetadata">the cursor is sent as stream metadata instead of being drawn into the frames</param>
+internal readonly record struct ScreenCastStream(uint NodeId, bool CursorMetadata);
+
 internal static class XdgScreenCastHandler
 {
-    public static async Task<uint?> PromptUserAsync(WaylandOutput output)
+    public static async Task<ScreenCastStream?> PromptUserAsync(WaylandOutput output)
     {
         var data = new XdgScreenData(output);
         if (await data.InitDbusAsync())
-            return data.NodeId;
+            return new ScreenCastStream(data.NodeId, data.CursorMetadata);
         return null;
     }
 }
 
 internal class XdgScreenData : IDisposable
 {
+    private const uint CursorModeEmbedded = 2;
+    private const uint CursorModeMetadata = 4;
+
     internal uint NodeId;
+    internal bool CursorMetadata;
     private WaylandOutput _output;
 
     private Connection _dbus = null!;
@@ -138,13 +145,32 @@ internal class XdgScreenData : IDisposable
         return val == 1;
     }
 
+    private async Task<uint> GetCursorModeAsync()
+    {
+        try
+        {
+            var modes = await _screenCast.GetAvailableCursorModesAsync();
+            if ((modes & CursorModeMetadata) != 0)
+                return CursorModeMetadata;
+        }
+        catch (Exception e)
+        {
+            Console.WriteLine($"Could not query cursor modes: {e.Message}");
+        }
+        return CursorModeEmbedded;
+    }
+
     private async Task<bool> SelectSourcesAsync()
     {
+        // with the cursor as metadata, pointer motion does not produce new frames
+        var cursorMode = await GetCursorModeAsync();
+        CursorMetadata = cursorMode == CursorModeMetadata;
+
         var options = new Dictionary<string, object>
         {
             ["handle_token"] = _token,
             ["type"] = 1U,
-            ["cursor_mode"] = 2U, // embedded
+            ["cursor_mode"] = cursorMode,
             ["persist_mode"] = 2U, // persistent
         };
 
@@ -0,0 +1,105 @@
+using Tmds.Linux;
+
+namespace WlxOverlay.GFX;
+
+/// <summary>
+/// Keeps the EGLImages of the DMA-BUFs that a capture cycles through, so that each buffer is imported once.
+/// A buffer is recognized by the inode behind the fd of its first plane, which stays the same
+/// whichever fd it arrives on, together with the rest of its attributes.
+/// </summary>
+public class EglImageCache : IDisposable
+{
+    private readonly record struct Key(ulong Device, ulong Inode, int Layout);
+
+    private readonly int _capacity;
+
+    // least recently used first
+    private readonly List<(Key key, IntPtr image)> _images = new();
+    private ulong _uncached;
+
+    public EglImageCache(int capacity = 16)
+    {
+        _capacity = capacity;
+    }
+
+    /// <summary>
+    /// Find or import the image for a DMA-BUF. The image belongs to the cache,
+    /// it stays valid until it is evicted or the cache is cleared.
+    /// </summary>
+    /// <param name="attribs">attributes for eglCreateImage, terminated by EGL_NONE</param>
+    /// <returns>IntPtr.Zero if the import failed, see error</returns>
+    public IntPtr GetOrCreate(nint[] attribs, out EglEnum error)
+    {
+        error = EglEnum.Success;
+
+        var key = KeyOf(attribs);
+        for (var i = _images.Count - 1; i >= 0; i--)
+        {
+            if (_images[i].key != key)
+                continue;
+
+            var hit = _images[i];
+            _images.RemoveAt(i);
+            _images.Add(hit);
+            return hit.image;
+        }
+
+        var image = EGL.CreateImage(EGL.Display, IntPtr.Zero, EglEnum.LinuxDmaBufExt, IntPtr.Zero, attribs);
+        error = EGL.GetError();
+        if (error != EglEnum.Success)
+            return IntPtr.Zero;
+
+        if (_images.Count >= _capacity)
+        {
+            EGL.DestroyImage(EGL.Display, _images[0].image);
+            _images.RemoveAt(0);
+        }
+
+        _images.Add((key, image));
+        return image;
+    }
+
+    /// <summary>
+    /// Drop all images, e.g. after the buffers were renegotiated.
+    /// Textures keep showing the last image they were given.
+    /// </summary>
+    public void Clear()
+    {
+        foreach (var (_, image) in _images)
+            EGL.DestroyImage(EGL.Display, image);
+        _images.Clear();
+    }
+
+    public void Dispose()
+    {
+        Clear();
+    }
+
+    private unsafe Key KeyOf(nint[] attribs)
+    {
+        var fd = -1;
+        var layout = new HashCode();
+
+        for (var i = 0; i + 1 < attribs.Length && attribs[i] != (nint)EglEnum.None; i += 2)
+        {
+            var name = (EglEnum)attribs[i];
+            if (name == EglEnum.DmaBufPlane0FdExt)
+                fd = (int)attribs[i + 1];
+
+            // the fds of a buffer may change from frame to frame, everything else may not
+            if (name is EglEnum.DmaBufPlane0FdExt or EglEnum.DmaBufPlane1FdExt
+                or EglEnum.DmaBufPlane2FdExt or EglEnum.DmaBufPlane3FdExt)
+                continue;
+
+            layout.Add(attribs[i]);
+            layout.Add(attribs[i + 1]);
+        }
+
+        stat st;
+        if (fd >= 0 && LibC.fstat(fd, &st) == 0)
+            return new Key((ulong)st.st_dev, (ulong)st.st_ino, layout.ToHashCode());
+
+        // not a buffer that can be recognized again, so it will only be evicted
+        return new Key(ulong.MaxValue, _uncached++, 0);
+    }
+}
@@ -4,7 +4,10 @@ public interface ITexture : IDisposable
 {
     public void LoadRawImage(IntPtr ptr, GraphicsFormat graphicsFormat, uint newWidth = 0, uint newHeight = 0);
 
-    public void LoadRawSubImage(IntPtr ptr, GraphicsFormat graphicsFormat, int xOffset, int yOffset, int width, int height);
+    /// <summary>
+    /// Upload a region of the texture. rowLength is the source stride in pixels, 0 for tightly packed rows.
+    /// </summary>
+    public void LoadRawSubImage(IntPtr ptr, GraphicsFormat graphicsFormat, int xOffset, int yOffset, int width, int height, int rowLength = 0);
 
     public void CopyTo(ITexture target, uint width = 0, uint height = 0, int srcX = 0, int srcY = 0, int dstX = 0, int dstY = 0);
 
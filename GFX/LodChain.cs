@@ -0,0 +1,97 @@
+namespace WlxOverlay.GFX;
+
+/// <summary>
+/// Downsampled copies of a dynamic texture, each half the size of the one before it.
+/// Every level is drawn from the previous one, so each pass is a 2x2 box filter and nothing aliases.
+/// An overlay that looks small can submit a level instead of the full texture.
+/// </summary>
+public sealed class LodChain : IDisposable
+{
+    private const int MaxLevel = 4;
+    private const uint MinWidth = 128;
+
+    // a coarser level is only picked once it still has this much headroom, so the level does not flicker
+    private const float Hysteresis = 1.25f;
+
+    private readonly GraphicsFormat _format;
+    private readonly ITexture?[] _levels = new ITexture?[MaxLevel + 1];
+
+    /// <summary>
+    /// 0 for the full texture, n for 1/2^n of its size.
+    /// </summary>
+    public int Level { get; private set; }
+
+    public LodChain(GraphicsFormat format)
+    {
+        _format = format;
+    }
+
+    /// <summary>
+    /// Pick the coarsest level that still has texelsNeeded texels across.
+    /// </summary>
+    /// <returns>true if the level changed</returns>
+    public bool SelectLevel(uint sourceWidth, float texelsNeeded)
+    {
+        var level = Level;
+        while (level > 0 && (sourceWidth >> level) < texelsNeeded)
+            level--;
+        while (level < MaxLevel
+               && sourceWidth >> (level + 1) >= Math.Max(MinWidth, texelsNeeded * Hysteresis))
+            level++;
+
+        if (level == Level)
+            return false;
+
+        Level = level;
+        return true;
+    }
+
+    /// <summary>
+    /// Redraw the levels up to the selected one from source.
+    /// </summary>
+    /// <returns>the texture to submit</returns>
+    public ITexture Update(ITexture source)
+    {
+        var prev = source;
+        for (var i = 1; i <= Level; i++)
+        {
+            var w = Math.Max(1u, source.GetWidth() >> i);
+            var h = Math.Max(1u, source.GetHeight() >> i);
+
+            var tex = _levels[i];
+            if (tex == null || tex.GetWidth() != w || tex.GetHeight() != h)
+            {
+                tex?.Dispose();
+                tex = _levels[i] = GraphicsEngine.Instance.EmptyTexture(w, h, _format, dynamic: true);
+            }
+
+            GraphicsEngine.Renderer.Begin(tex);
+            GraphicsEngine.Renderer.DrawSprite(prev, 0, h, w, -h);
+            GraphicsEngine.Renderer.End();
+            prev = tex;
+        }
+
+        return prev;
+    }
+
+    /// <summary>
+    /// Free the levels above the selected one, e.g. after moving closer.
+    /// </summary>
+    public void Trim()
+    {
+        for (var i = Level + 1; i <= MaxLevel; i++)
+        {
+            _levels[i]?.Dispose();
+            _levels[i] = null;
+        }
+    }
+
+    public void Dispose()
+    {
+        for (var i = 0; i <= MaxLevel; i++)
+        {
+            _levels[i]?.Dispose();
+            _levels[i] = null;
+        }
+    }
+}
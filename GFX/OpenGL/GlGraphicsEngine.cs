@@ -21,6 +21,9 @@ public sealed class GlGraphicsEngine : IGraphicsEngine
     public static GlShader SrgbShader = null!;
     public static GlShader QuadShader = null!;
 
+    // scaled CPU captures write into this when streaming_upload is on and the driver supports it
+    public static GlUploadRing? UploadRing;
+
     public GlGraphicsEngine()
     {
         if (GraphicsEngine.Instance != null)
@@ -68,6 +71,14 @@ public sealed class GlGraphicsEngine : IGraphicsEngine
         SrgbShader = new GlShader(_gl, vertShader, GetShaderPath("srgb.frag"));
         QuadShader = new GlShader(_gl, vertShader, GetShaderPath("tex-color.frag"));
 
+        if (Config.Instance.StreamingUpload)
+        {
+            if (GlUploadRing.IsSupported(_gl))
+                UploadRing = new GlUploadRing(_gl);
+            else
+                Console.WriteLine("GL_ARB_buffer_storage not supported, uploading textures directly.");
+        }
+
         GraphicsEngine.Renderer = new GlRenderer(_gl);
         MainLoop.Initialize();
     }
@@ -167,6 +178,8 @@ public sealed class GlGraphicsEngine : IGraphicsEngine
 
     public void Shutdown()
     {
+        UploadRing?.Dispose();
+        UploadRing = null;
         _window.Close();
     }
 
@@ -16,6 +16,13 @@ public class GlTexture : ITexture
 
     private readonly bool _dynamic;
 
+    // the region handed out by ReserveSubImage, uploaded by CommitSubImage
+    private IntPtr _reserved;
+    private bool _reservedInRing;
+    private GraphicsFormat _reservedFormat;
+    private int _reservedWidth;
+    private int _reservedHeight;
+
     public unsafe GlTexture(GL gl, string path, InternalFormat internalFormat = InternalFormat.Rgba8)
     {
         _gl = gl;
@@ -102,9 +109,11 @@ public class GlTexture : ITexture
         _gl.TexParameter(TextureTarget.Texture2D, TextureParameterName.TextureMinFilter, (int)GLEnum.Linear);
         _gl.TexParameter(TextureTarget.Texture2D, TextureParameterName.TextureMagFilter, (int)GLEnum.Linear);
         _gl.TexParameter(TextureTarget.Texture2D, TextureParameterName.TextureBaseLevel, 0);
-        _gl.TexParameter(TextureTarget.Texture2D, TextureParameterName.TextureMaxLevel, 8);
+        //Mipmaps of dynamic textures would only hold the first frame, so those have none.
+        _gl.TexParameter(TextureTarget.Texture2D, TextureParameterName.TextureMaxLevel, _dynamic ? 0 : 8);
         //Generating mipmaps.
-        _gl.GenerateMipmap(TextureTarget.Texture2D);
+        if (!_dynamic)
+            _gl.GenerateMipmap(TextureTarget.Texture2D);
         _gl.DebugAssertSuccess();
     }
 
@@ -153,15 +162,57 @@ public class GlTexture : ITexture
         _gl.DebugAssertSuccess();
     }
 
-    public unsafe void LoadRawSubImage(IntPtr ptr, GraphicsFormat graphicsFormat, int xOffset, int yOffset, int width, int height)
+    public unsafe void LoadRawSubImage(IntPtr ptr, GraphicsFormat graphicsFormat, int xOffset, int yOffset, int width, int height, int rowLength = 0)
     {
         var (pf, pt) = GlGraphicsEngine.GraphicsFormatAsInput(graphicsFormat);
 
         var d = ptr.ToPointer();
         Bind();
 
+        if (rowLength > 0)
+            _gl.PixelStore(GLEnum.UnpackRowLength, rowLength);
+
         _gl.TexSubImage2D(TextureTarget.Texture2D, 0, xOffset, yOffset, (uint)width, (uint)height, pf, pt, d);
         _gl.DebugAssertSuccess();
+
+        if (rowLength > 0)
+            _gl.PixelStore(GLEnum.UnpackRowLength, 0);
+    }
+
+    /// <summary>
+    /// Get memory for a width x height region of tightly packed pixels, which CommitSubImage then uploads.
+    /// With streaming_upload this is a part of the upload ring, so the producer writes the pixels only once.
+    /// </summary>
+    /// <param name="scratch">room for the region, used when the ring is off or full</param>
+    public IntPtr ReserveSubImage(GraphicsFormat graphicsFormat, int width, int height, IntPtr scratch)
+    {
+        var ring = GlGraphicsEngine.UploadRing?.TryReserve(graphicsFormat, width, height) ?? IntPtr.Zero;
+
+        _reservedInRing = ring != IntPtr.Zero;
+        _reserved = _reservedInRing ? ring : scratch;
+        _reservedFormat = graphicsFormat;
+        _reservedWidth = width;
+        _reservedHeight = height;
+        return _reserved;
+    }
+
+    /// <summary>
+    /// Upload the region written since ReserveSubImage.
+    /// </summary>
+    public void CommitSubImage(int xOffset, int yOffset)
+    {
+        if (_reserved == IntPtr.Zero)
+            return;
+
+        if (_reservedInRing)
+        {
+            Bind();
+            GlGraphicsEngine.UploadRing!.Commit(xOffset, yOffset);
+        }
+        else
+            LoadRawSubImage(_reserved, _reservedFormat, xOffset, yOffset, _reservedWidth, _reservedHeight);
+
+        _reserved = IntPtr.Zero;
     }
 
     public void CopyTo(ITexture target, uint width = 0, uint height = 0, int srcX = 0, int srcY = 0, int dstX = 0, int dstY = 0)
@@ -0,0 +1,204 @@
+using Silk.NET.OpenGL;
+
+namespace WlxOverlay.GFX.OpenGL;
+
+/// <summary>
+/// A persistently mapped pixel unpack buffer (ARB_buffer_storage) that producers write pixels into directly.
+/// A region is reserved, filled in place, e.g. by a scaler, and committed, which issues TexSubImage2D from the buffer,
+/// so the pixels are written once and the driver can copy them on the GPU timeline instead of stalling the render thread.
+/// Every commit is fenced, and a part of the ring is only handed out again once its fence has signaled.
+/// </summary>
+public sealed class GlUploadRing : IDisposable
+{
+    // room for this many of the largest upload seen, so the GPU can lag behind by a couple of frames
+    private const int UploadsInFlight = 3;
+    private const nuint MinSize = 16 * 1024 * 1024;
+    private const int Alignment = 256;
+    private const ulong FenceTimeoutNs = 100_000_000;
+
+    private static readonly SyncObjectMask FlushCommands = (SyncObjectMask)GLEnum.SyncFlushCommandsBit;
+
+    private readonly GL _gl;
+
+    private uint _buffer;
+    private nuint _size;
+    private IntPtr _map;
+    private nuint _head;
+    private bool _broken;
+
+    // the region handed out by TryReserve, 0 bytes if there is none
+    private nuint _reserved;
+    private GraphicsFormat _reservedFormat;
+    private int _reservedWidth;
+    private int _reservedHeight;
+
+    // uploads the GPU may still be reading from
+    private readonly List<(nuint start, nuint end, IntPtr fence)> _fences = new();
+
+    public GlUploadRing(GL gl)
+    {
+        _gl = gl;
+    }
+
+    public static bool IsSupported(GL gl)
+    {
+        return gl.IsExtensionPresent("GL_ARB_buffer_storage");
+    }
+
+    /// <summary>
+    /// Reserve room for width x height tightly packed pixels, to be written by the caller and uploaded with Commit.
+    /// </summary>
+    /// <returns>where to write the pixels, or IntPtr.Zero if the ring cannot be used and the upload should be done directly</returns>
+    public IntPtr TryReserve(GraphicsFormat format, int width, int height)
+    {
+        _reserved = 0;
+        if (_broken || width <= 0 || height <= 0)
+            return IntPtr.Zero;
+
+        var bytes = (nuint)(width * BytesPerPixel(format)) * (nuint)height;
+
+        if (bytes * UploadsInFlight > _size && !Reallocate(bytes * UploadsInFlight))
+            return IntPtr.Zero;
+
+        if (_head + bytes > _size)
+            _head = 0;
+
+        if (!WaitForRange(_head, _head + bytes))
+            return IntPtr.Zero;
+
+        _reserved = bytes;
+        _reservedFormat = format;
+        _reservedWidth = width;
+        _reservedHeight = height;
+        return _map + (nint)_head;
+    }
+
+    /// <summary>
+    /// Upload the pixels of the last reservation to a region of the texture bound to GL_TEXTURE_2D.
+    /// </summary>
+    public unsafe void Commit(int x, int y)
+    {
+        if (_reserved == 0)
+            return;
+
+        var (pf, pt) = GlGraphicsEngine.GraphicsFormatAsInput(_reservedFormat);
+
+        // rows in the ring are tightly packed, which is the alignment the engine keeps set anyway
+        _gl.BindBuffer(BufferTargetARB.PixelUnpackBuffer, _buffer);
+        _gl.PixelStore(GLEnum.UnpackAlignment, 1);
+        _gl.TexSubImage2D(TextureTarget.Texture2D, 0, x, y, (uint)_reservedWidth, (uint)_reservedHeight, pf, pt, (void*)_head);
+        _gl.BindBuffer(BufferTargetARB.PixelUnpackBuffer, 0);
+        _gl.DebugAssertSuccess();
+
+        var fence = _gl.FenceSync(SyncCondition.SyncGpuCommandsComplete, 0);
+        _fences.Add((_head, _head + _reserved, fence));
+
+        _head = Align(_head + _reserved);
+        _reserved = 0;
+    }
+
+    /// <summary>
+    /// Wait for the uploads that read from [start, end) and retire the ones that are already done.
+    /// </summary>
+    private bool WaitForRange(nuint start, nuint end)
+    {
+        for (var i = _fences.Count - 1; i >= 0; i--)
+        {
+            var f = _fences[i];
+            var overlaps = f.start < end && start < f.end;
+            var status = overlaps
+                ? _gl.ClientWaitSync(f.fence, FlushCommands, FenceTimeoutNs)
+                : _gl.ClientWaitSync(f.fence, 0, 0);
+
+            if (status == GLEnum.TimeoutExpired && !overlaps)
+                continue;
+
+            if (status is GLEnum.TimeoutExpired or GLEnum.WaitFailed)
+            {
+                Console.WriteLine("ERR Upload ring: GPU did not finish reading an upload.");
+                return false;
+            }
+
+            _gl.DeleteSync(f.fence);
+            _fences.RemoveAt(i);
+        }
+
+        return true;
+    }
+
+    private unsafe bool Reallocate(nuint size)
+    {
+        Free();
+
+        _size = Align(size < MinSize ? MinSize : size);
+        _head = 0;
+
+        _buffer = _gl.GenBuffer();
+        _gl.BindBuffer(BufferTargetARB.PixelUnpackBuffer, _buffer);
+
+        const BufferStorageMask storage =
+            BufferStorageMask.MapWriteBit | BufferStorageMask.MapPersistentBit | BufferStorageMask.MapCoherentBit;
+        const MapBufferAccessMask access =
+            MapBufferAccessMask.WriteBit | MapBufferAccessMask.PersistentBit | MapBufferAccessMask.CoherentBit;
+
+        _gl.BufferStorage(BufferStorageTarget.PixelUnpackBuffer, _size, null, storage);
+        _map = (IntPtr)_gl.MapBufferRange(BufferTargetARB.PixelUnpackBuffer, 0, _size, access);
+        _gl.BindBuffer(BufferTargetARB.PixelUnpackBuffer, 0);
+        _gl.DebugAssertSuccess();
+
+        if (_map != IntPtr.Zero)
+            return true;
+
+        Console.WriteLine($"ERR Upload ring: could not map {_size} bytes, uploading directly.");
+        Free();
+        _broken = true;
+        return false;
+    }
+
+    private void Free()
+    {
+        _reserved = 0;
+        foreach (var f in _fences)
+        {
+            _gl.ClientWaitSync(f.fence, FlushCommands, FenceTimeoutNs);
+            _gl.DeleteSync(f.fence);
+        }
+        _fences.Clear();
+
+        if (_buffer != 0)
+        {
+            _gl.BindBuffer(BufferTargetARB.PixelUnpackBuffer, _buffer);
+            _gl.UnmapBuffer(BufferTargetARB.PixelUnpackBuffer);
+            _gl.BindBuffer(BufferTargetARB.PixelUnpackBuffer, 0);
+            _gl.DeleteBuffer(_buffer);
+            _gl.DebugAssertSuccess();
+        }
+
+        _buffer = 0;
+        _map = IntPtr.Zero;
+        _size = 0;
+    }
+
+    public void Dispose()
+    {
+        Free();
+    }
+
+    private static nuint Align(nuint offset)
+    {
+        return (offset + Alignment - 1) & ~(nuint)(Alignment - 1);
+    }
+
+    private static int BytesPerPixel(GraphicsFormat format)
+    {
+        return format switch
+        {
+            GraphicsFormat.RGBA8 or GraphicsFormat.BGRA8 or GraphicsFormat.R32 => 4,
+            GraphicsFormat.RGB8 or GraphicsFormat.BGR8 => 3,
+            GraphicsFormat.RG8 or GraphicsFormat.R16 => 2,
+            GraphicsFormat.R8 => 1,
+            GraphicsFormat.RGB_Float => 12,
+            _ => throw new ArgumentOutOfRangeException(nameof(format), format, null)
+        };
+    }
+}
@@ -10,6 +10,11 @@ public class BaseOverlay : IDisposable
     public Transform3D Transform;
     public ITexture? Texture;
 
+    /// <summary>
+    /// The texture submitted to the XR runtime. Interactions still map onto Texture.
+    /// </summary>
+    public virtual ITexture? DisplayTexture => Texture;
+
     public uint ZOrder = 0;
     public bool ShowHideBinding = true;
 
@@ -196,6 +201,17 @@ public class BaseOverlay : IDisposable
         UploadTransform();
     }
 
+    /// <summary>
+    /// How wide the overlay appears from the HMD, in degrees.
+    /// </summary>
+    public float AngularWidth()
+    {
+        var hmd = XrBackend.Current.Input.HmdTransform;
+        var width = WidthInMeters * Transform.basis.x.Length();
+        var distance = Mathf.Max(Transform.origin.DistanceTo(hmd.origin), 0.01f);
+        return Mathf.RadToDeg(2f * Mathf.Atan(width / (2f * distance)));
+    }
+
     public void ResetTransform()
     {
         if (SavedSpawnPosition == null)
@@ -53,16 +53,83 @@ public class DesktopOverlay : BaseOverlay, IInteractable, IGrabbable
         OnOrientationChanged();
 
         Texture = GraphicsEngine.Instance.EmptyTexture((uint)Screen.Size.X, (uint)Screen.Size.Y, internalFormat: GraphicsFormat.RGB8, dynamic: true);
+        if (Config.Instance.DesktopLod)
+            _lod = new LodChain(GraphicsFormat.RGB8);
         base.Initialize();
     }
 
     protected internal override void Render()
     {
-        _capture.TryApplyToTexture(Texture!);
+        if (_capture is PipeWireCapture pw && Config.Instance.PipewireAdaptiveSize)
+            AdaptCaptureSize(pw);
+
+        var updated = _capture.TryApplyToTexture(Texture!);
+        if (_lod != null)
+            UpdateLod(updated);
+
         _mouseMoved = false;
         base.Render();
     }
 
+    public override ITexture? DisplayTexture => _lodTexture ?? Texture;
+
+    private LodChain? _lod;
+    private ITexture? _lodTexture;
+
+    /// <summary>
+    /// Submit the smallest downsampled copy that still has every pixel the HMD can resolve at the current distance.
+    /// </summary>
+    private void UpdateLod(bool frameUpdated)
+    {
+        var changed = _lod!.SelectLevel(Texture!.GetWidth(), AngularWidth() * PixelsPerDegree);
+        if (changed)
+            _lod.Trim();
+
+        if (_lod.Level == 0)
+        {
+            _lodTexture = null;
+            return;
+        }
+
+        if (frameUpdated || changed || _lodTexture == null)
+            _lodTexture = _lod.Update(Texture);
+    }
+
+    // enough for the sharpest HMDs to show every pixel that reaches them
+    private const float PixelsPerDegree = 32f;
+    private const int MinCaptureWidth = 256;
+
+    private DateTime _nextAdapt = DateTime.MinValue;
+    private DateTime _lastHover = DateTime.MinValue;
+    private int _adaptedWidth;
+
+    /// <summary>
+    /// Request frames no larger than what the HMD can resolve at the current distance.
+    /// </summary>
+    private void AdaptCaptureSize(PipeWireCapture capture)
+    {
+        if (_nextAdapt > DateTime.UtcNow)
+            return;
+        _nextAdapt = DateTime.UtcNow.AddSeconds(1);
+
+        var native = Screen.Size;
+        var width = (int)Mathf.Clamp(AngularWidth() * PixelsPerDegree, Math.Min(MinCaptureWidth, native.X), native.X);
+        width = Math.Min((width + 15) / 16 * 16, native.X);
+
+        // small movements should not renegotiate the stream, but reaching full size always does
+        if (_adaptedWidth <= 0 || Math.Abs(width - _adaptedWidth) >= _adaptedWidth / 4
+            || (width == native.X) != (_adaptedWidth == native.X))
+            _adaptedWidth = width;
+
+        var height = (int)((long)native.Y * _adaptedWidth / native.X);
+        var fps = (uint)XrBackend.Current.DisplayFrequency;
+        if (_adaptedWidth < native.X && DateTime.UtcNow - _lastHover > TimeSpan.FromSeconds(5))
+            fps /= 2;
+
+        // repeated requests are dropped by the capture
+        capture.RequestFormat(new Vector2Int(_adaptedWidth, height), fps);
+    }
+
     public override void Show()
     {
         _capture.Resume();
@@ -94,6 +161,7 @@ public class DesktopOverlay : BaseOverlay, IInteractable, IGrabbable
 
     public void OnPointerHover(PointerHit hitData)
     {
+        _lastHover = DateTime.UtcNow;
         if (hitData.isPrimary && !_mouseMoved && _freezeCursor < DateTime.UtcNow)
             _mouseMoved = _mouseMoved || MoveMouse(hitData);
     }
@@ -179,6 +247,7 @@ public class DesktopOverlay : BaseOverlay, IInteractable, IGrabbable
     public override void Dispose()
     {
         _capture.Dispose();
+        _lod?.Dispose();
         Texture?.Dispose();
         base.Dispose();
     }
@@ -0,0 +1,45 @@
+using static WaylandSharp.Client;
+
+#nullable enable
+namespace WaylandSharp
+{
+    // the parts of wl_display that a thread of its own needs to read events without blocking in Dispatch()
+    public unsafe partial class WlDisplay
+    {
+        public int GetFd()
+        {
+            CheckIfDisposed();
+            return WlDisplayGetFd((_WlDisplay*)_proxyObject);
+        }
+
+        public int PrepareRead()
+        {
+            CheckIfDisposed();
+            return WlDisplayPrepareRead((_WlDisplay*)_proxyObject);
+        }
+
+        public int ReadEvents()
+        {
+            CheckIfDisposed();
+            return WlDisplayReadEvents((_WlDisplay*)_proxyObject);
+        }
+
+        public void CancelRead()
+        {
+            CheckIfDisposed();
+            WlDisplayCancelRead((_WlDisplay*)_proxyObject);
+        }
+
+        public int DispatchPending()
+        {
+            CheckIfDisposed();
+            return WlDisplayDispatchPending((_WlDisplay*)_proxyObject);
+        }
+
+        public int Flush()
+        {
+            CheckIfDisposed();
+            return WlDisplayFlush((_WlDisplay*)_proxyObject);
+        }
+    }
+}
@@ -77,6 +77,12 @@ public class Config
 
     public string WaylandCapture;
     public bool WaylandColorSwap;
+    public int PipewireRtPriority;
+    public float PipewireLatencyLog;
+    public bool PipewireAdaptiveSize;
+    public bool DesktopLod;
+
+    public bool StreamingUpload;
 
     public string[]? VolumeUpCmd;
     public string[]? VolumeDnCmd;
@@ -120,6 +126,8 @@ public class Config
 
     public string DefaultScreen;
 
+    public Dictionary<string, int[]>? OutputSize;
+
     public const string DefaultPrimaryColor = "#006080";
     public const string DefaultShiftColor = "#B03000";
     public const string DefaultAltColor = "#600080";
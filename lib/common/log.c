@@ -0,0 +1,30 @@
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+// longer messages are cut off
+#define MAX_MESSAGE 512
+
+static log_fn callback;
+
+void log_set_callback(log_fn fn)
+{
+    callback = fn;
+}
+
+void log_msg(int32_t level, const char *fmt, ...)
+{
+    char message[MAX_MESSAGE];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    log_fn fn = callback;
+    if (fn)
+        fn(level, message);
+    else
+        fprintf(level >= LOG_LEVEL_WARN ? stderr : stdout, "%s\n", message);
+}
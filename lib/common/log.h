@@ -0,0 +1,29 @@
+#ifndef WLX_LOG_H
+#define WLX_LOG_H
+
+#include <stdint.h>
+
+enum log_level {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO = 1,
+    LOG_LEVEL_WARN = 2,
+    LOG_LEVEL_ERROR = 3,
+};
+
+/**
+ * Receives one complete message at a time, without a trailing newline.
+ * May be called from any thread the library runs on.
+ */
+typedef void (*log_fn)(int32_t level, const char *message);
+
+// every library keeps its own callback, even when several are loaded into one process
+#define LOG_HIDDEN __attribute__((visibility("hidden")))
+
+/**
+ * Send messages to fn, or to stdout/stderr if fn is NULL
+ */
+LOG_HIDDEN void log_set_callback(log_fn fn);
+
+LOG_HIDDEN void log_msg(int32_t level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif //WLX_LOG_H
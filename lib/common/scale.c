@@ -0,0 +1,478 @@
+#include "scale.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCALE_X86
+#include <immintrin.h>
+#endif
+
+// bilinear weights, 7 bits so that a full 2x2 blend fits madd_epi16
+#define WEIGHT_BITS 7
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+static int32_t simd_supported = -1;
+static int32_t simd_level = -1;
+
+struct bilinear_tap {
+    int32_t i;
+    int32_t w;
+};
+
+static inline int32_t format_bpp(int32_t format)
+{
+    return format == SCALE_FORMAT_RGB ? 3 : 4;
+}
+
+static inline void store_px(uint8_t *dst, uint32_t b, uint32_t g, uint32_t r, int32_t format)
+{
+    if (format == SCALE_FORMAT_BGRA) {
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+        dst[3] = 0xFF;
+    } else {
+        dst[0] = r;
+        dst[1] = g;
+        dst[2] = b;
+        if (format == SCALE_FORMAT_RGBA)
+            dst[3] = 0xFF;
+    }
+}
+
+static void box_px(const uint8_t *src, int32_t src_stride, int32_t fx, int32_t fy,
+                   uint8_t *dst, int32_t format)
+{
+    uint32_t b = 0, g = 0, r = 0;
+    for (int32_t y = 0; y < fy; y++) {
+        const uint8_t *s = src + y * src_stride;
+        for (int32_t x = 0; x < fx; x++, s += 4) {
+            b += s[0];
+            g += s[1];
+            r += s[2];
+        }
+    }
+
+    uint32_t n = fx * fy;
+    store_px(dst, (b + n / 2) / n, (g + n / 2) / n, (r + n / 2) / n, format);
+}
+
+/**
+ * Map each destination column (or row) to its left source sample and blend weight.
+ * Both samples are always in bounds, so the kernels need no edge handling.
+ */
+static void bilinear_taps(struct bilinear_tap *taps, int32_t src_n, int32_t dst_n)
+{
+    int64_t step = ((int64_t) src_n << 16) / dst_n;
+    int64_t pos = step / 2 - 0x8000;
+
+    for (int32_t i = 0; i < dst_n; i++, pos += step) {
+        int64_t p = pos < 0 ? 0 : pos;
+        int32_t idx = (int32_t) (p >> 16);
+        int32_t w = (int32_t) ((p & 0xFFFF) >> (16 - WEIGHT_BITS));
+
+        if (idx >= src_n - 1) {
+            idx = src_n - 2;
+            w = WEIGHT_ONE;
+        }
+
+        taps[i].i = idx;
+        taps[i].w = w;
+    }
+}
+
+static inline void bilinear_px(const uint8_t *top, const uint8_t *bot, int32_t wx, int32_t wy,
+                               uint8_t *dst, int32_t format)
+{
+    uint32_t c[3];
+    for (int i = 0; i < 3; i++) {
+        uint32_t t = top[i] * (WEIGHT_ONE - wx) + top[i + 4] * wx;
+        uint32_t b = bot[i] * (WEIGHT_ONE - wx) + bot[i + 4] * wx;
+        c[i] = (t * (WEIGHT_ONE - wy) + b * wy + (1 << (2 * WEIGHT_BITS - 1))) >> (2 * WEIGHT_BITS);
+    }
+    store_px(dst, c[0], c[1], c[2], format);
+}
+
+static void box_row_c(const uint8_t *src, int32_t src_stride, int32_t fx, int32_t fy,
+                      uint8_t *dst, int32_t dst_w, int32_t format)
+{
+    int32_t bpp = format_bpp(format);
+    for (int32_t x = 0; x < dst_w; x++)
+        box_px(src + x * fx * 4, src_stride, fx, fy, dst + x * bpp, format);
+}
+
+static void bilinear_row_c(const uint8_t *top, const uint8_t *bot, int32_t wy,
+                           const struct bilinear_tap *taps, uint8_t *dst, int32_t dst_w,
+                           int32_t format)
+{
+    int32_t bpp = format_bpp(format);
+    for (int32_t x = 0; x < dst_w; x++)
+        bilinear_px(top + taps[x].i * 4, bot + taps[x].i * 4, taps[x].w, wy, dst + x * bpp, format);
+}
+
+#ifdef SCALE_X86
+
+/**
+ * Write 4 BGRx pixels in the requested format
+ */
+__attribute__((target("sse4.1")))
+static inline void emit4_sse41(uint8_t *dst, __m128i px, int32_t format)
+{
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+
+    if (format == SCALE_FORMAT_BGRA) {
+        _mm_storeu_si128((__m128i *) dst, _mm_or_si128(px, alpha));
+    } else if (format == SCALE_FORMAT_RGBA) {
+        const __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        _mm_storeu_si128((__m128i *) dst, _mm_or_si128(_mm_shuffle_epi8(px, swap), alpha));
+    } else {
+        const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        __m128i rgb = _mm_shuffle_epi8(px, pack);
+        _mm_storel_epi64((__m128i *) dst, rgb);
+        uint32_t tail = (uint32_t) _mm_extract_epi32(rgb, 2);
+        memcpy(dst + 8, &tail, 4);
+    }
+}
+
+/**
+ * Sum two source pixels of two rows each: 4 pixels in, 2 sums out
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i box2_sum2_sse41(const uint8_t *r0, const uint8_t *r1)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *) r0);
+    __m128i b = _mm_loadu_si128((const __m128i *) r1);
+
+    __m128i lo = _mm_add_epi16(_mm_cvtepu8_epi16(a), _mm_cvtepu8_epi16(b));
+    __m128i hi = _mm_add_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(a, 8)),
+                               _mm_cvtepu8_epi16(_mm_srli_si128(b, 8)));
+
+    return _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+}
+
+__attribute__((target("sse4.1")))
+static void box2_row_sse41(const uint8_t *src, int32_t src_stride,
+                           uint8_t *dst, int32_t dst_w, int32_t format)
+{
+    const __m128i round = _mm_set1_epi16(2);
+    const uint8_t *r1 = src + src_stride;
+    int32_t bpp = format_bpp(format);
+    int32_t x = 0;
+
+    for (; x + 4 <= dst_w; x += 4) {
+        __m128i s01 = _mm_srli_epi16(_mm_add_epi16(box2_sum2_sse41(src + x * 8, r1 + x * 8), round), 2);
+        __m128i s23 = _mm_srli_epi16(_mm_add_epi16(box2_sum2_sse41(src + x * 8 + 16, r1 + x * 8 + 16), round), 2);
+        emit4_sse41(dst + x * bpp, _mm_packus_epi16(s01, s23), format);
+    }
+
+    box_row_c(src + x * 8, src_stride, 2, 2, dst + x * bpp, dst_w - x, format);
+}
+
+/**
+ * Sum a 4x4 block: 16 pixels in, 1 sum in the low 4 lanes
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i box4_sum1_sse41(const uint8_t *src, int32_t src_stride)
+{
+    __m128i s = _mm_setzero_si128();
+    for (int y = 0; y < 4; y++) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + y * src_stride));
+        s = _mm_add_epi16(s, _mm_cvtepu8_epi16(v));
+        s = _mm_add_epi16(s, _mm_cvtepu8_epi16(_mm_srli_si128(v, 8)));
+    }
+    return _mm_add_epi16(s, _mm_srli_si128(s, 8));
+}
+
+__attribute__((target("sse4.1")))
+static void box4_row_sse41(const uint8_t *src, int32_t src_stride,
+                           uint8_t *dst, int32_t dst_w, int32_t format)
+{
+    const __m128i round = _mm_set1_epi16(8);
+    int32_t bpp = format_bpp(format);
+    int32_t x = 0;
+
+    for (; x + 4 <= dst_w; x += 4) {
+        const uint8_t *s = src + x * 16;
+        __m128i s01 = _mm_unpacklo_epi64(box4_sum1_sse41(s, src_stride),
+                                         box4_sum1_sse41(s + 16, src_stride));
+        __m128i s23 = _mm_unpacklo_epi64(box4_sum1_sse41(s + 32, src_stride),
+                                         box4_sum1_sse41(s + 48, src_stride));
+        s01 = _mm_srli_epi16(_mm_add_epi16(s01, round), 4);
+        s23 = _mm_srli_epi16(_mm_add_epi16(s23, round), 4);
+        emit4_sse41(dst + x * bpp, _mm_packus_epi16(s01, s23), format);
+    }
+
+    box_row_c(src + x * 16, src_stride, 4, 4, dst + x * bpp, dst_w - x, format);
+}
+
+__attribute__((target("sse4.1")))
+static void convert_row_sse41(const uint8_t *src, uint8_t *dst, int32_t dst_w, int32_t format)
+{
+    int32_t bpp = format_bpp(format);
+    int32_t x = 0;
+
+    for (; x + 4 <= dst_w; x += 4)
+        emit4_sse41(dst + x * bpp, _mm_loadu_si128((const __m128i *) (src + x * 4)), format);
+
+    box_row_c(src + x * 4, 0, 1, 1, dst + x * bpp, dst_w - x, format);
+}
+
+/**
+ * Blend one 2x2 neighbourhood, result in the low 4 bytes
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i bilinear_px_sse41(const uint8_t *top, const uint8_t *bot,
+                                        __m128i w, __m128i wy)
+{
+    const __m128i round = _mm_set1_epi32(1 << (2 * WEIGHT_BITS - 1));
+
+    __m128i t = _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) top)), w);
+    __m128i b = _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) bot)), w);
+    t = _mm_add_epi16(t, _mm_srli_si128(t, 8));
+    b = _mm_add_epi16(b, _mm_srli_si128(b, 8));
+
+    __m128i v = _mm_madd_epi16(_mm_unpacklo_epi16(t, b), wy);
+    v = _mm_srli_epi32(_mm_add_epi32(v, round), 2 * WEIGHT_BITS);
+    v = _mm_packs_epi32(v, v);
+    return _mm_packus_epi16(v, v);
+}
+
+/**
+ * Expand the horizontal weights of each tap to 16 bit lanes: 4x (1 - w), 4x w
+ */
+__attribute__((target("sse4.1")))
+static void bilinear_weights_sse41(__m128i *wx, const struct bilinear_tap *taps, int32_t dst_w)
+{
+    for (int32_t x = 0; x < dst_w; x++) {
+        __m128i w0 = _mm_set1_epi16((short) (WEIGHT_ONE - taps[x].w));
+        __m128i w1 = _mm_set1_epi16((short) taps[x].w);
+        wx[x] = _mm_unpacklo_epi64(w0, w1);
+    }
+}
+
+__attribute__((target("sse4.1")))
+static void bilinear_row_sse41(const uint8_t *top, const uint8_t *bot, int32_t wy,
+                               const struct bilinear_tap *taps, const __m128i *wx,
+                               uint8_t *dst, int32_t dst_w, int32_t format)
+{
+    __m128i wyv = _mm_set1_epi32((wy << 16) | (WEIGHT_ONE - wy));
+    int32_t bpp = format_bpp(format);
+    int32_t x = 0;
+
+    for (; x + 4 <= dst_w; x += 4) {
+        __m128i px[4];
+        for (int i = 0; i < 4; i++) {
+            const struct bilinear_tap *t = &taps[x + i];
+            px[i] = bilinear_px_sse41(top + t->i * 4, bot + t->i * 4, wx[x + i], wyv);
+        }
+        __m128i p01 = _mm_unpacklo_epi32(px[0], px[1]);
+        __m128i p23 = _mm_unpacklo_epi32(px[2], px[3]);
+        emit4_sse41(dst + x * bpp, _mm_unpacklo_epi64(p01, p23), format);
+    }
+
+    bilinear_row_c(top, bot, wy, taps + x, dst + x * bpp, dst_w - x, format);
+}
+
+/**
+ * 2x2 box of 8 source pixels of two rows, 4 BGRx pixels out
+ */
+__attribute__((target("avx2")))
+static inline __m128i box2_px4_avx2(const uint8_t *r0, const uint8_t *r1)
+{
+    const __m256i round = _mm256_set1_epi16(2);
+    __m256i a = _mm256_loadu_si256((const __m256i *) r0);
+    __m256i b = _mm256_loadu_si256((const __m256i *) r1);
+
+    // lanes hold pixel pairs: lo = (p0 p1)(p2 p3), hi = (p4 p5)(p6 p7)
+    __m256i lo = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(a)),
+                                  _mm256_cvtepu8_epi16(_mm256_castsi256_si128(b)));
+    __m256i hi = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1)),
+                                  _mm256_cvtepu8_epi16(_mm256_extracti128_si256(b, 1)));
+
+    // (q0 q2)(q1 q3)
+    __m256i s = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+    s = _mm256_srli_epi16(_mm256_add_epi16(s, round), 2);
+    s = _mm256_packus_epi16(s, s);
+
+    return _mm_unpacklo_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+}
+
+__attribute__((target("avx2")))
+static void box2_row_avx2(const uint8_t *src, int32_t src_stride,
+                          uint8_t *dst, int32_t dst_w, int32_t format)
+{
+    const uint8_t *r1 = src + src_stride;
+    int32_t bpp = format_bpp(format);
+    int32_t x = 0;
+
+    for (; x + 8 <= dst_w; x += 8) {
+        emit4_sse41(dst + x * bpp, box2_px4_avx2(src + x * 8, r1 + x * 8), format);
+        emit4_sse41(dst + (x + 4) * bpp, box2_px4_avx2(src + x * 8 + 32, r1 + x * 8 + 32), format);
+    }
+
+    box2_row_sse41(src + x * 8, src_stride, dst + x * bpp, dst_w - x, format);
+}
+
+#endif // SCALE_X86
+
+static int32_t detect_simd(void)
+{
+#ifdef SCALE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SCALE_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SCALE_SIMD_SSE41;
+#endif
+    return SCALE_SIMD_NONE;
+}
+
+int32_t scale_simd_level(void)
+{
+    if (simd_supported < 0)
+        simd_supported = detect_simd();
+    if (simd_level < 0 || simd_level > simd_supported)
+        return simd_supported;
+    return simd_level;
+}
+
+void scale_set_simd_level(int32_t level)
+{
+    simd_level = level;
+}
+
+static void scale_box(const uint8_t *src, int32_t src_stride, int32_t fx, int32_t fy,
+                      uint8_t *dst, int32_t dst_w, int32_t dst_h, int32_t dst_stride,
+                      int32_t format, int32_t simd)
+{
+    for (int32_t y = 0; y < dst_h; y++) {
+        const uint8_t *s = src + (int64_t) y * fy * src_stride;
+        uint8_t *d = dst + (int64_t) y * dst_stride;
+
+#ifdef SCALE_X86
+        if (simd >= SCALE_SIMD_SSE41 && fx == fy) {
+            if (fx == 1) {
+                convert_row_sse41(s, d, dst_w, format);
+                continue;
+            }
+            if (fx == 2) {
+                if (simd >= SCALE_SIMD_AVX2)
+                    box2_row_avx2(s, src_stride, d, dst_w, format);
+                else
+                    box2_row_sse41(s, src_stride, d, dst_w, format);
+                continue;
+            }
+            if (fx == 4) {
+                box4_row_sse41(s, src_stride, d, dst_w, format);
+                continue;
+            }
+        }
+#else
+        (void) simd;
+#endif
+        box_row_c(s, src_stride, fx, fy, d, dst_w, format);
+    }
+}
+
+void scale_cache_free(struct scale_cache *cache)
+{
+    free(cache->taps);
+    free(cache->weights);
+    memset(cache, 0, sizeof(*cache));
+}
+
+/**
+ * Make sure the cache holds the tables for this size and instruction set
+ *
+ * @return false if they could not be allocated
+ */
+static bool scale_cache_update(struct scale_cache *cache, int32_t src_w, int32_t src_h,
+                               int32_t dst_w, int32_t dst_h, int32_t simd)
+{
+    if (cache->taps && cache->src_w == src_w && cache->src_h == src_h
+        && cache->dst_w == dst_w && cache->dst_h == dst_h && cache->simd == simd)
+        return true;
+
+    scale_cache_free(cache);
+
+    cache->taps = malloc(sizeof(struct bilinear_tap) * (dst_w + dst_h));
+    if (!cache->taps)
+        return false;
+
+    bilinear_taps(cache->taps, src_w, dst_w);
+    bilinear_taps(cache->taps + dst_w, src_h, dst_h);
+
+#ifdef SCALE_X86
+    if (simd >= SCALE_SIMD_SSE41) {
+        cache->weights = aligned_alloc(sizeof(__m128i), sizeof(__m128i) * dst_w);
+        if (cache->weights)
+            bilinear_weights_sse41(cache->weights, cache->taps, dst_w);
+    }
+#endif
+
+    cache->src_w = src_w;
+    cache->src_h = src_h;
+    cache->dst_w = dst_w;
+    cache->dst_h = dst_h;
+    cache->simd = simd;
+    return true;
+}
+
+static void scale_bilinear(const uint8_t *src, int32_t src_w, int32_t src_h, int32_t src_stride,
+                           uint8_t *dst, int32_t dst_w, int32_t dst_h, int32_t dst_stride,
+                           int32_t format, int32_t simd, struct scale_cache *cache)
+{
+    struct scale_cache local = { 0 };
+    if (!cache)
+        cache = &local;
+
+    if (!scale_cache_update(cache, src_w, src_h, dst_w, dst_h, simd))
+        return;
+
+    const struct bilinear_tap *tx = cache->taps;
+    const struct bilinear_tap *ty = tx + dst_w;
+
+#ifdef SCALE_X86
+    const __m128i *wx = cache->weights;
+#else
+    (void) simd;
+#endif
+
+    for (int32_t y = 0; y < dst_h; y++) {
+        const uint8_t *top = src + (int64_t) ty[y].i * src_stride;
+        const uint8_t *bot = top + src_stride;
+        uint8_t *d = dst + (int64_t) y * dst_stride;
+
+#ifdef SCALE_X86
+        if (wx) {
+            bilinear_row_sse41(top, bot, ty[y].w, tx, wx, d, dst_w, format);
+            continue;
+        }
+#endif
+        bilinear_row_c(top, bot, ty[y].w, tx, d, dst_w, format);
+    }
+
+    scale_cache_free(&local);
+}
+
+void scale_bgrx(const uint8_t *src, int32_t src_w, int32_t src_h, int32_t src_stride,
+                uint8_t *dst, int32_t dst_w, int32_t dst_h, int32_t dst_stride,
+                int32_t format, struct scale_cache *cache)
+{
+    if (dst_w <= 0 || dst_h <= 0 || src_w < dst_w || src_h < dst_h)
+        return;
+
+    int32_t simd = scale_simd_level();
+    bool exact = src_w % dst_w == 0 && src_h % dst_h == 0;
+
+    // bilinear needs two samples per direction, a 1px wide source is always exact
+    if (exact || src_w < 2 || src_h < 2) {
+        int32_t fx = src_w / dst_w;
+        int32_t fy = src_h / dst_h;
+        scale_box(src, src_stride, fx, fy, dst, dst_w, dst_h, dst_stride, format, simd);
+    } else {
+        scale_bilinear(src, src_w, src_h, src_stride, dst, dst_w, dst_h, dst_stride, format, simd, cache);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef WLX_SCALE_H
+#define WLX_SCALE_H
+
+#include <stdint.h>
+
+enum scale_format {
+    SCALE_FORMAT_BGRA = 0,
+    SCALE_FORMAT_RGBA = 1,
+    SCALE_FORMAT_RGB = 2,
+};
+
+enum scale_simd {
+    SCALE_SIMD_NONE = 0,
+    SCALE_SIMD_SSE41 = 1,
+    SCALE_SIMD_AVX2 = 2,
+};
+
+struct bilinear_tap;
+
+/**
+ * Filter tables of the last bilinear scale, kept per screen so that frames of
+ * the same size don't rebuild them. Zero initialize, free with scale_cache_free.
+ */
+struct scale_cache {
+    int32_t src_w;
+    int32_t src_h;
+    int32_t dst_w;
+    int32_t dst_h;
+    int32_t simd;
+    // dst_w column taps followed by dst_h row taps
+    struct bilinear_tap *taps;
+    // per column weights of the SIMD kernels, NULL without them
+    void *weights;
+};
+
+/**
+ * Downscale a BGRx image and convert it to the given format.
+ *
+ * A box filter is used when the source is an exact integer multiple of the
+ * destination in both directions, bilinear filtering otherwise.
+ * The alpha channel of the output is always opaque.
+ *
+ * @param src first pixel of the source
+ * @param src_stride bytes between source rows
+ * @param dst first pixel of the destination
+ * @param dst_stride bytes between destination rows
+ * @param format one of enum scale_format
+ * @param cache tables of the previous call, or NULL to build them for this one only
+ */
+void scale_bgrx(const uint8_t *src, int32_t src_w, int32_t src_h, int32_t src_stride,
+                uint8_t *dst, int32_t dst_w, int32_t dst_h, int32_t dst_stride,
+                int32_t format, struct scale_cache *cache);
+
+void scale_cache_free(struct scale_cache *cache);
+
+/**
+ * @return the instruction set used by scale_bgrx, one of enum scale_simd
+ */
+int32_t scale_simd_level(void);
+
+/**
+ * Limit the instruction set used by scale_bgrx, for comparing kernels.
+ * Levels the CPU does not support are ignored.
+ */
+void scale_set_simd_level(int32_t level);
+
+#endif //WLX_SCALE_H
@@ -0,0 +1,193 @@
+/*
+ * Checks the SIMD kernels of scale.c against the scalar path and measures their throughput.
+ * Runs on the CPU only.
+ *
+ * usage: scale_bench [width height [frames]]
+ *
+ * Every case is first run on a set of odd sizes with padded strides and random pixels,
+ * and the output of each instruction set the CPU supports must match the scalar one
+ * byte for byte. Then each case is timed on a width x height frame (default 3840x2160).
+ * Exits with 1 if any output differs.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scale.h"
+
+struct scale_case {
+    const char *name;
+    // destination size as a fraction of the source
+    int32_t num;
+    int32_t den;
+};
+
+static const struct scale_case cases[] = {
+        { "convert",     1, 1 },
+        { "box 2x",      1, 2 },
+        { "box 3x",      1, 3 },
+        { "box 4x",      1, 4 },
+        { "bilinear",    5, 12 },
+        { "bilinear",    2, 3 },
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static const char *format_names[] = { "bgra", "rgba", "rgb" };
+static const char *simd_names[] = { "c", "sse4.1", "avx2" };
+
+// source sizes for the correctness check, chosen to leave tails for every kernel width
+static const int32_t check_sizes[][2] = {
+        { 1, 1 }, { 2, 2 }, { 7, 5 }, { 24, 12 }, { 61, 37 }, { 240, 135 }, { 1923, 1081 },
+};
+
+#define NUM_CHECK_SIZES (sizeof(check_sizes) / sizeof(check_sizes[0]))
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void fill_random(uint8_t *px, size_t len, uint32_t seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1664525U + 1013904223U;
+        px[i] = (uint8_t) (seed >> 24);
+    }
+}
+
+static int32_t bpp(int32_t format)
+{
+    return format == SCALE_FORMAT_RGB ? 3 : 4;
+}
+
+/**
+ * Scale one source size at every supported level and compare against the scalar output
+ *
+ * @return false if any level differs
+ */
+static bool check_one(const struct scale_case *c, int32_t format, int32_t src_w, int32_t src_h,
+                      int32_t max_simd)
+{
+    int32_t dst_w = src_w * c->num / c->den;
+    int32_t dst_h = src_h * c->num / c->den;
+    if (dst_w < 1 || dst_h < 1)
+        return true;
+
+    // padded strides, so rows that run over show up as differences
+    int32_t src_stride = src_w * 4 + 12;
+    int32_t dst_stride = dst_w * bpp(format) + 5;
+    size_t dst_len = (size_t) dst_stride * dst_h;
+
+    uint8_t *src = malloc((size_t) src_stride * src_h);
+    uint8_t *ref = malloc(dst_len);
+    uint8_t *out = malloc(dst_len);
+    fill_random(src, (size_t) src_stride * src_h, (uint32_t) (src_w * 31 + src_h));
+
+    memset(ref, 0xA5, dst_len);
+    scale_set_simd_level(SCALE_SIMD_NONE);
+    scale_bgrx(src, src_w, src_h, src_stride, ref, dst_w, dst_h, dst_stride, format, NULL);
+
+    // every level runs twice, the second time from the tables cached by the first
+    struct scale_cache cache = { 0 };
+    bool ok = true;
+    for (int32_t level = SCALE_SIMD_NONE; level <= max_simd; level++) {
+        scale_set_simd_level(level);
+
+        for (int pass = 0; pass < 2; pass++) {
+            memset(out, 0xA5, dst_len);
+            scale_bgrx(src, src_w, src_h, src_stride, out, dst_w, dst_h, dst_stride, format, &cache);
+
+            size_t i = 0;
+            while (i < dst_len && out[i] == ref[i])
+                i++;
+            if (i == dst_len)
+                continue;
+
+            printf("MISMATCH %s %s %s%s %dx%d -> %dx%d at row %zu byte %zu: %d, scalar %d\n",
+                   c->name, format_names[format], simd_names[level], pass ? " cached" : "",
+                   src_w, src_h, dst_w, dst_h, i / dst_stride, i % dst_stride, out[i], ref[i]);
+            ok = false;
+            break;
+        }
+    }
+
+    scale_cache_free(&cache);
+    free(src);
+    free(ref);
+    free(out);
+    return ok;
+}
+
+static void bench_one(const struct scale_case *c, int32_t format, int32_t level,
+                      const uint8_t *src, int32_t src_w, int32_t src_h, uint8_t *dst, int32_t frames)
+{
+    int32_t dst_w = src_w * c->num / c->den;
+    int32_t dst_h = src_h * c->num / c->den;
+    int32_t dst_stride = dst_w * bpp(format);
+
+    // like a capture, the tables are built for the first frame and reused after
+    struct scale_cache cache = { 0 };
+    scale_set_simd_level(level);
+    scale_bgrx(src, src_w, src_h, src_w * 4, dst, dst_w, dst_h, dst_stride, format, &cache);
+
+    double t0 = now_ms();
+    for (int32_t f = 0; f < frames; f++)
+        scale_bgrx(src, src_w, src_h, src_w * 4, dst, dst_w, dst_h, dst_stride, format, &cache);
+    double ms = (now_ms() - t0) / frames;
+    scale_cache_free(&cache);
+
+    printf("%-9s %-5s %-7s %5dx%-5d %8.3f %9.1f\n",
+           c->name, format_names[format], simd_names[level], dst_w, dst_h,
+           ms, (double) src_w * src_h / 1e3 / ms);
+}
+
+int main(int argc, char **argv)
+{
+    int32_t width = 3840, height = 2160, frames = 50;
+
+    if (argc > 2) {
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+    if (argc > 3)
+        frames = atoi(argv[3]);
+
+    if (width < 2 || height < 2 || frames < 1) {
+        fprintf(stderr, "usage: %s [width height [frames]]\n", argv[0]);
+        return 2;
+    }
+
+    scale_set_simd_level(-1);
+    int32_t max_simd = scale_simd_level();
+    printf("cpu supports: %s\n\n", simd_names[max_simd]);
+
+    bool ok = true;
+    for (size_t c = 0; c < NUM_CASES; c++)
+        for (int32_t format = 0; format <= SCALE_FORMAT_RGB; format++)
+            for (size_t s = 0; s < NUM_CHECK_SIZES; s++)
+                ok &= check_one(&cases[c], format, check_sizes[s][0], check_sizes[s][1], max_simd);
+
+    printf("%s\n\n", ok ? "all kernels match the scalar path" : "KERNELS DIFFER FROM THE SCALAR PATH");
+
+    uint8_t *src = malloc((size_t) width * height * 4);
+    uint8_t *dst = malloc((size_t) width * height * 4);
+    fill_random(src, (size_t) width * height * 4, 1);
+
+    printf("%-9s %-5s %-7s %11s %8s %9s\n", "case", "fmt", "simd", "out", "ms", "Mpx/s");
+    for (size_t c = 0; c < NUM_CASES; c++)
+        for (int32_t format = 0; format <= SCALE_FORMAT_RGB; format++)
+            for (int32_t level = SCALE_SIMD_NONE; level <= max_simd; level++)
+                bench_one(&cases[c], format, level, src, width, height, dst, frames);
+
+    free(src);
+    free(dst);
+    return ok ? 0 : 1;
+}
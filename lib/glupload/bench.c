@@ -0,0 +1,401 @@
+/*
+ * Compares the two ways WlxOverlay can upload a downscaled CPU capture frame:
+ * scaling into client memory and calling glTexSubImage2D from there, and scaling
+ * straight into a persistently mapped pixel unpack buffer (ARB_buffer_storage) and
+ * calling glTexSubImage2D from the buffer, with a fence per upload.
+ * Runs headless on EGL surfaceless, e.g. on Mesa llvmpipe with LIBGL_ALWAYS_SOFTWARE=1.
+ *
+ * usage: glupload_bench [-s WxH] [-d WxH] [-n frames]
+ *
+ * Every frame, the source changes and is scaled from -s to -d (default half of it)
+ * with the scalers of lib/common, then the texture is copied into another one, so that
+ * the GPU has to wait for the upload like a draw would.
+ *
+ * This measures what the driver does with each path, it does not run GlUploadRing.cs.
+ * The mapped path here is a fixed set of slots with as little bookkeeping as possible,
+ * so its numbers are an upper bound for what the ring can gain, and bugs of the ring
+ * itself can only be caught in the application.
+ *
+ * "blocked" is the time spent scaling and in the upload calls, which is what the render
+ * thread pays. "frame" adds the copy and a glFlush. The total is taken after a glFinish at the end.
+ *
+ * Exits with 1 if a context cannot be created or the paths upload different pixels.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+
+#include "scale.h"
+
+// frames the GPU may lag behind before a slot has to be waited for
+#define NUM_SLOTS 3
+#define FENCE_TIMEOUT_NS 100000000ULL
+
+enum mode {
+    MODE_DIRECT,
+    MODE_MAPPED,
+    NUM_MODES,
+};
+
+static const char *mode_names[NUM_MODES] = { "direct", "mapped" };
+
+struct slots {
+    GLuint buffer;
+    size_t slot_size;
+    uint8_t *map;
+    GLsync fences[NUM_SLOTS];
+    int32_t next;
+    int64_t waits;
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int32_t n, double p)
+{
+    int32_t i = (int32_t) ceil(p / 100.0 * n) - 1;
+    return sorted[i < 0 ? 0 : i];
+}
+
+static bool create_context(void)
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        fprintf(stderr, "unable to initialize EGL\n");
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL has no desktop OpenGL\n");
+        return false;
+    }
+
+    const EGLint attribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 5,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE,
+    };
+
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        fprintf(stderr, "unable to create a surfaceless OpenGL 4.5 core context\n");
+        return false;
+    }
+
+    printf("%s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+}
+
+static bool slots_init(struct slots *s, size_t slot_size)
+{
+    memset(s, 0, sizeof(*s));
+    s->slot_size = slot_size;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &s->buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) (slot_size * NUM_SLOTS), NULL, flags);
+    s->map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) (slot_size * NUM_SLOTS), flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    return s->map != NULL;
+}
+
+static void slots_destroy(struct slots *s)
+{
+    for (int32_t i = 0; i < NUM_SLOTS; i++) {
+        if (!s->fences[i])
+            continue;
+        glClientWaitSync(s->fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+        glDeleteSync(s->fences[i]);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &s->buffer);
+}
+
+/**
+ * @return the next slot once the GPU is done reading it, NULL on timeout
+ */
+static uint8_t *slots_reserve(struct slots *s)
+{
+    GLsync fence = s->fences[s->next];
+    if (fence) {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            s->waits++;
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+        }
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+            return NULL;
+
+        glDeleteSync(fence);
+        s->fences[s->next] = NULL;
+    }
+
+    return s->map + s->slot_size * s->next;
+}
+
+static void slots_commit(struct slots *s, int32_t w, int32_t h)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->buffer);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE,
+                    (const void *) (s->slot_size * s->next));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    s->fences[s->next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s->next = (s->next + 1) % NUM_SLOTS;
+}
+
+static GLuint create_texture(int32_t w, int32_t h)
+{
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return tex;
+}
+
+static void paint(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    for (int32_t y = 0; y < h; y++)
+        for (int32_t x = 0; x < w; x++)
+            px[(size_t) y * w + x] = (uint32_t) (frame * 0x010203 + x * 7 + y * 13) | 0xFF000000U;
+}
+
+/**
+ * Scale and upload one frame, into client memory or a slot
+ *
+ * @return false if the frame went to client memory because no slot was free
+ */
+static bool upload(enum mode mode, struct slots *s, uint8_t *client, const uint32_t *px,
+                   int32_t src_w, int32_t src_h, int32_t dst_w, int32_t dst_h, struct scale_cache *cache)
+{
+    uint8_t *slot = mode == MODE_MAPPED ? slots_reserve(s) : NULL;
+    uint8_t *dst = slot ? slot : client;
+
+    scale_bgrx((const uint8_t *) px, src_w, src_h, src_w * 4, dst, dst_w, dst_h, dst_w * 3,
+               SCALE_FORMAT_RGB, cache);
+
+    if (slot) {
+        slots_commit(s, dst_w, dst_h);
+        return true;
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, dst_w, dst_h, GL_RGB, GL_UNSIGNED_BYTE, client);
+    return mode == MODE_DIRECT;
+}
+
+/**
+ * Upload the same frames through both paths and compare what ends up in the textures.
+ * The odd destination width makes rows that are not 4 byte aligned.
+ */
+static bool verify(void)
+{
+    const int32_t src_w = 301, src_h = 207, dst_w = 201, dst_h = 138;
+    size_t dst_len = (size_t) dst_w * dst_h * 3;
+
+    uint32_t *px = malloc((size_t) src_w * src_h * 4);
+    uint8_t *client = malloc(dst_len);
+    uint8_t *a = malloc(dst_len);
+    uint8_t *b = malloc(dst_len);
+    struct scale_cache cache = { 0 };
+    struct slots s;
+    bool ok = slots_init(&s, dst_len);
+
+    GLuint tex_a = create_texture(dst_w, dst_h), tex_b = create_texture(dst_w, dst_h);
+
+    for (int32_t f = 0; f < NUM_SLOTS * 2 && ok; f++) {
+        paint(px, src_w, src_h, f);
+
+        glBindTexture(GL_TEXTURE_2D, tex_a);
+        upload(MODE_DIRECT, &s, client, px, src_w, src_h, dst_w, dst_h, &cache);
+
+        glBindTexture(GL_TEXTURE_2D, tex_b);
+        ok &= upload(MODE_MAPPED, &s, client, px, src_w, src_h, dst_w, dst_h, &cache);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, tex_a);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, a);
+    glBindTexture(GL_TEXTURE_2D, tex_b);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, b);
+
+    if (ok && memcmp(a, b, dst_len) != 0) {
+        printf("MISMATCH: mapped and direct uploads differ\n");
+        ok = false;
+    }
+
+    slots_destroy(&s);
+    scale_cache_free(&cache);
+    glDeleteTextures(1, &tex_a);
+    glDeleteTextures(1, &tex_b);
+    free(px);
+    free(client);
+    free(a);
+    free(b);
+    return ok;
+}
+
+static void run(enum mode mode, int32_t src_w, int32_t src_h, int32_t dst_w, int32_t dst_h, int32_t frames)
+{
+    size_t dst_len = (size_t) dst_w * dst_h * 3;
+    uint32_t *px = calloc((size_t) src_w * src_h, 4);
+    uint8_t *client = malloc(dst_len);
+    double *blocked = calloc(frames, sizeof(double));
+    double *frame_ms = calloc(frames, sizeof(double));
+    struct scale_cache cache = { 0 };
+
+    GLuint tex = create_texture(dst_w, dst_h), copy = create_texture(dst_w, dst_h);
+    struct slots s = { 0 };
+    if (mode == MODE_MAPPED && !slots_init(&s, dst_len)) {
+        printf("%-7s unable to map the pixel buffer\n", mode_names[mode]);
+        return;
+    }
+
+    int64_t fallbacks = 0;
+    glFinish();
+    double t_start = now_ms();
+
+    for (int32_t f = 0; f < frames; f++) {
+        paint(px, src_w, src_h, f);
+
+        double t0 = now_ms();
+        glBindTexture(GL_TEXTURE_2D, tex);
+        if (!upload(mode, &s, client, px, src_w, src_h, dst_w, dst_h, &cache))
+            fallbacks++;
+        double t1 = now_ms();
+
+        // sample the texture like the overlay does when it is submitted
+        glCopyImageSubData(tex, GL_TEXTURE_2D, 0, 0, 0, 0, copy, GL_TEXTURE_2D, 0, 0, 0, 0, dst_w, dst_h, 1);
+        glFlush();
+
+        blocked[f] = t1 - t0;
+        frame_ms[f] = now_ms() - t0;
+    }
+
+    glFinish();
+    double total = now_ms() - t_start;
+
+    if (mode == MODE_MAPPED)
+        slots_destroy(&s);
+    scale_cache_free(&cache);
+    glDeleteTextures(1, &tex);
+    glDeleteTextures(1, &copy);
+
+    qsort(blocked, frames, sizeof(double), cmp_double);
+    qsort(frame_ms, frames, sizeof(double), cmp_double);
+
+    printf("%-7s %9.3f %9.3f %9.3f %9.3f %9.3f %7" PRId64 " %7" PRId64 "\n",
+           mode_names[mode],
+           percentile(blocked, frames, 50), percentile(blocked, frames, 95), blocked[frames - 1],
+           percentile(frame_ms, frames, 50), total / frames, s.waits, fallbacks);
+
+    free(px);
+    free(client);
+    free(blocked);
+    free(frame_ms);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-s WxH] [-d WxH] [-n frames]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    int32_t src_w = 2560, src_h = 1440, dst_w = 0, dst_h = 0, frames = 200;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:d:n:")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &src_w, &src_h) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd':
+                if (sscanf(optarg, "%dx%d", &dst_w, &dst_h) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (dst_w == 0 && dst_h == 0) {
+        dst_w = src_w / 2;
+        dst_h = src_h / 2;
+    }
+
+    if (src_w < 2 || src_h < 2 || dst_w <= 0 || dst_h <= 0 || dst_w > src_w || dst_h > src_h || frames <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!create_context())
+        return 1;
+
+    // the texture rows are tightly packed RGB, like the engine uploads them
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    if (!verify())
+        return 1;
+
+    printf("%dx%d scaled to %dx%d, %d frames\n\n", src_w, src_h, dst_w, dst_h, frames);
+
+    printf("%-7s %9s %9s %9s %9s %9s %7s %7s\n",
+           "path", "blk p50", "blk p95", "blk max", "frame p50", "total/fr", "waits", "direct");
+
+    for (int32_t m = 0; m < NUM_MODES; m++)
+        run(m, src_w, src_h, dst_w, dst_h, frames);
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Measures what tile hashing costs against what it saves on upload,
+ * for a few synthetic desktop workloads. Runs on the CPU only.
+ *
+ * usage: wlxdiff_bench [width height [tile_size [frames [upload_gbps]]]]
+ *
+ * Without a GPU, upload time is modelled from the number of bytes uploaded
+ * at upload_gbps, the rate TexSubImage2D reaches from client memory
+ * (default 3 GB/s, measure your own driver to get a better estimate).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wlxdiff.h"
+
+struct workload {
+    const char *name;
+    void (*step)(uint32_t *px, int32_t w, int32_t h, int32_t frame);
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void fill(uint32_t *px, int32_t w, int32_t x, int32_t y, int32_t rw, int32_t rh, uint32_t c)
+{
+    for (int32_t j = y; j < y + rh; j++)
+        for (int32_t i = x; i < x + rw; i++)
+            px[j * w + i] = c + (uint32_t) (i * 7 + j * 13);
+}
+
+static void step_idle(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    (void) px; (void) w; (void) h; (void) frame;
+}
+
+static void step_clock(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    (void) h;
+    if (frame % 60 == 0)
+        fill(px, w, w - 120, 8, 100, 24, (uint32_t) frame);
+}
+
+static void step_cursor_blink(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    fill(px, w, w / 3, h / 2, 2, 18, frame % 30 < 15 ? 0xFFFFFFFF : 0);
+}
+
+static void step_typing(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    int32_t col = (frame * 9) % (w / 2);
+    int32_t line = ((frame * 9) / (w / 2)) % (h / 20);
+    fill(px, w, 40 + col, 40 + line * 18, 9, 18, (uint32_t) frame * 31);
+}
+
+static void step_scroll(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    // a browser window scrolling by 4 lines per frame
+    int32_t x = w / 4, y = h / 8, rw = w / 2, rh = h * 3 / 4;
+    for (int32_t j = y; j < y + rh; j++)
+        for (int32_t i = x; i < x + rw; i++)
+            px[j * w + i] = (uint32_t) ((j + frame * 4) * 2654435761U) ^ (uint32_t) i;
+}
+
+static void step_video(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    int32_t rw = w / 3 < 1280 ? w / 3 : 1280;
+    int32_t rh = rw * 9 / 16;
+    fill(px, w, (w - rw) / 2, (h - rh) / 2, rw, rh, (uint32_t) frame * 0x010101);
+}
+
+static void step_fullscreen(uint32_t *px, int32_t w, int32_t h, int32_t frame)
+{
+    fill(px, w, 0, 0, w, h, (uint32_t) frame * 0x01010101);
+}
+
+static const struct workload workloads[] = {
+    { "idle",         step_idle },
+    { "clock",        step_clock },
+    { "cursor blink", step_cursor_blink },
+    { "typing",       step_typing },
+    { "scrolling",    step_scroll },
+    { "video",        step_video },
+    { "fullscreen",   step_fullscreen },
+};
+
+/**
+ * Check that every simd level finds the same rects
+ */
+static bool verify(int32_t w, int32_t h, int32_t tile)
+{
+    uint32_t *px = malloc(sizeof(uint32_t) * w * h);
+    int32_t max = wlxdiff_simd_level();
+    bool ok = true;
+
+    for (size_t k = 0; k < sizeof(workloads) / sizeof(workloads[0]); k++) {
+        struct wlxdiff *ref = wlxdiff_create(tile);
+        struct wlxdiff *cmp[3] = { NULL };
+        for (int32_t l = 1; l <= max; l++)
+            cmp[l] = wlxdiff_create(tile);
+
+        fill(px, w, 0, 0, w, h, 0);
+        for (int32_t f = 0; f < 8 && ok; f++) {
+            workloads[k].step(px, w, h, f);
+
+            struct wlxdiff_rect *ref_r, *cmp_r;
+            wlxdiff_set_simd_level(0);
+            int32_t n = wlxdiff_update(ref, (uint8_t *) px, w, h, w * 4, &ref_r);
+
+            for (int32_t l = 1; l <= max; l++) {
+                wlxdiff_set_simd_level(l);
+                int32_t m = wlxdiff_update(cmp[l], (uint8_t *) px, w, h, w * 4, &cmp_r);
+                if (m != n || memcmp(ref_r, cmp_r, sizeof(struct wlxdiff_rect) * n) != 0) {
+                    printf("MISMATCH: %s frame %d, simd level %d\n", workloads[k].name, f, l);
+                    ok = false;
+                }
+            }
+        }
+
+        wlxdiff_destroy(ref);
+        for (int32_t l = 1; l <= max; l++)
+            wlxdiff_destroy(cmp[l]);
+    }
+
+    wlxdiff_set_simd_level(-1);
+    free(px);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int32_t w = argc > 2 ? atoi(argv[1]) : 2560;
+    int32_t h = argc > 2 ? atoi(argv[2]) : 1440;
+    int32_t tile = argc > 3 ? atoi(argv[3]) : WLXDIFF_DEFAULT_TILE;
+    int32_t frames = argc > 4 ? atoi(argv[4]) : 240;
+    double gbps = argc > 5 ? atof(argv[5]) : 3.0;
+
+    if (w <= 0 || h <= 0 || frames <= 0 || gbps <= 0) {
+        fprintf(stderr, "usage: %s [width height [tile_size [frames [upload_gbps]]]]\n", argv[0]);
+        return 1;
+    }
+
+    if (!verify(w, h, tile))
+        return 1;
+
+    uint32_t *px = malloc(sizeof(uint32_t) * w * h);
+    if (!px)
+        return 1;
+
+    // bytes per millisecond
+    double rate = gbps * 1e6;
+    double full_ms = (double) w * h * 4 / rate;
+
+    printf("%dx%d, %dpx tiles, %d frames, simd level %d\n", w, h, tile, frames, wlxdiff_simd_level());
+    printf("full frame upload at %.1f GB/s: %.3f ms\n\n", gbps, full_ms);
+    printf("%-14s %10s %10s %10s %12s %12s %8s\n",
+           "workload", "hash ms", "rects", "dirty %", "upload ms", "hash+upl ms", "saved");
+
+    for (size_t k = 0; k < sizeof(workloads) / sizeof(workloads[0]); k++) {
+        struct wlxdiff *diff = wlxdiff_create(tile);
+        struct wlxdiff_rect *rects;
+
+        fill(px, w, 0, 0, w, h, 0);
+        wlxdiff_update(diff, (uint8_t *) px, w, h, w * 4, &rects);
+
+        double hash_ms = 0;
+        int64_t dirty_px = 0, num_rects = 0;
+
+        for (int32_t f = 1; f <= frames; f++) {
+            workloads[k].step(px, w, h, f);
+
+            double t0 = now_ms();
+            int32_t n = wlxdiff_update(diff, (uint8_t *) px, w, h, w * 4, &rects);
+            hash_ms += now_ms() - t0;
+
+            for (int32_t i = 0; i < n; i++)
+                dirty_px += (int64_t) rects[i].w * rects[i].h;
+            num_rects += n;
+        }
+
+        hash_ms /= frames;
+        double dirty_ms = (double) dirty_px * 4 / rate / frames;
+        double saved = full_ms - (hash_ms + dirty_ms);
+
+        printf("%-14s %10.3f %10.2f %10.2f %12.3f %12.3f %7.0f%%\n", workloads[k].name,
+               hash_ms, (double) num_rects / frames,
+               100.0 * (double) dirty_px / ((double) w * h * frames),
+               dirty_ms, hash_ms + dirty_ms, 100.0 * saved / full_ms);
+
+        wlxdiff_destroy(diff);
+    }
+
+    free(px);
+    return 0;
+}
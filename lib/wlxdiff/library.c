@@ -0,0 +1,338 @@
+#include "wlxdiff.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WLXDIFF_X86
+#include <immintrin.h>
+#endif
+
+// past this many rects, one rect around all of them is cheaper to upload
+#define MAX_RECTS 32
+
+// the hash runs 8 independent xxHash32-style lanes over 32 bytes at a time,
+// so that every implementation produces the same value
+#define LANES 8
+#define PRIME1 0x9E3779B1U
+#define PRIME2 0x85EBCA77U
+#define PRIME5 0x165667B1U
+
+struct wlxdiff {
+    int32_t tile;
+    int32_t width;
+    int32_t height;
+    int32_t cols;
+    int32_t rows;
+    bool valid;
+
+    uint64_t *hashes;
+    uint32_t *acc;
+    struct wlxdiff_rect rects[MAX_RECTS];
+};
+
+typedef void (*hash_row_fn)(uint32_t *acc, const uint8_t *src, int32_t px);
+
+static int32_t simd_supported = -1;
+static int32_t simd_level = -1;
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t round32(uint32_t acc, uint32_t in)
+{
+    return rotl32(acc + in * PRIME2, 13) * PRIME1;
+}
+
+static void hash_tail(uint32_t *acc, const uint8_t *src, int32_t px)
+{
+    for (int32_t i = 0; i < px; i++) {
+        uint32_t w;
+        memcpy(&w, src + i * 4, 4);
+        acc[i] = round32(acc[i], w);
+    }
+}
+
+static void hash_row_c(uint32_t *acc, const uint8_t *src, int32_t px)
+{
+    int32_t i = 0;
+    for (; i + LANES <= px; i += LANES)
+        hash_tail(acc, src + i * 4, LANES);
+    hash_tail(acc, src + i * 4, px - i);
+}
+
+#ifdef WLXDIFF_X86
+
+__attribute__((target("sse4.1")))
+static inline __m128i round_sse41(__m128i acc, __m128i in)
+{
+    const __m128i p1 = _mm_set1_epi32((int) PRIME1);
+    const __m128i p2 = _mm_set1_epi32((int) PRIME2);
+
+    acc = _mm_add_epi32(acc, _mm_mullo_epi32(in, p2));
+    acc = _mm_or_si128(_mm_slli_epi32(acc, 13), _mm_srli_epi32(acc, 19));
+    return _mm_mullo_epi32(acc, p1);
+}
+
+__attribute__((target("sse4.1")))
+static void hash_row_sse41(uint32_t *acc, const uint8_t *src, int32_t px)
+{
+    __m128i a0 = _mm_loadu_si128((const __m128i *) acc);
+    __m128i a1 = _mm_loadu_si128((const __m128i *) (acc + 4));
+    int32_t i = 0;
+
+    for (; i + LANES <= px; i += LANES) {
+        a0 = round_sse41(a0, _mm_loadu_si128((const __m128i *) (src + i * 4)));
+        a1 = round_sse41(a1, _mm_loadu_si128((const __m128i *) (src + i * 4 + 16)));
+    }
+
+    _mm_storeu_si128((__m128i *) acc, a0);
+    _mm_storeu_si128((__m128i *) (acc + 4), a1);
+    hash_tail(acc, src + i * 4, px - i);
+}
+
+__attribute__((target("avx2")))
+static void hash_row_avx2(uint32_t *acc, const uint8_t *src, int32_t px)
+{
+    const __m256i p1 = _mm256_set1_epi32((int) PRIME1);
+    const __m256i p2 = _mm256_set1_epi32((int) PRIME2);
+    __m256i a = _mm256_loadu_si256((const __m256i *) acc);
+    int32_t i = 0;
+
+    for (; i + LANES <= px; i += LANES) {
+        __m256i in = _mm256_loadu_si256((const __m256i *) (src + i * 4));
+        a = _mm256_add_epi32(a, _mm256_mullo_epi32(in, p2));
+        a = _mm256_or_si256(_mm256_slli_epi32(a, 13), _mm256_srli_epi32(a, 19));
+        a = _mm256_mullo_epi32(a, p1);
+    }
+
+    _mm256_storeu_si256((__m256i *) acc, a);
+    hash_tail(acc, src + i * 4, px - i);
+}
+
+#endif // WLXDIFF_X86
+
+static int32_t detect_simd(void)
+{
+#ifdef WLXDIFF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return 2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return 1;
+#endif
+    return 0;
+}
+
+int32_t wlxdiff_simd_level(void)
+{
+    if (simd_supported < 0)
+        simd_supported = detect_simd();
+    if (simd_level < 0 || simd_level > simd_supported)
+        return simd_supported;
+    return simd_level;
+}
+
+void wlxdiff_set_simd_level(int32_t level)
+{
+    simd_level = level;
+}
+
+static hash_row_fn select_hash_row(void)
+{
+#ifdef WLXDIFF_X86
+    switch (wlxdiff_simd_level()) {
+        case 2:
+            return hash_row_avx2;
+        case 1:
+            return hash_row_sse41;
+    }
+#endif
+    return hash_row_c;
+}
+
+static uint64_t hash_finish(const uint32_t *acc, int32_t w, int32_t h)
+{
+    uint64_t hash = ((uint64_t) w << 32) | (uint32_t) h;
+    for (int i = 0; i < LANES; i++)
+        hash = (hash ^ acc[i]) * 0x100000001B3ULL;
+    return hash ^ (hash >> 29);
+}
+
+struct wlxdiff *wlxdiff_create(int32_t tile_size)
+{
+    struct wlxdiff *diff = calloc(1, sizeof(struct wlxdiff));
+    if (!diff)
+        return NULL;
+
+    if (tile_size <= 0)
+        tile_size = WLXDIFF_DEFAULT_TILE;
+    diff->tile = (tile_size + LANES - 1) / LANES * LANES;
+    return diff;
+}
+
+void wlxdiff_destroy(struct wlxdiff *diff)
+{
+    if (!diff)
+        return;
+
+    free(diff->hashes);
+    free(diff->acc);
+    free(diff);
+}
+
+void wlxdiff_reset(struct wlxdiff *diff)
+{
+    diff->valid = false;
+}
+
+static bool resize(struct wlxdiff *diff, int32_t width, int32_t height)
+{
+    int32_t cols = (width + diff->tile - 1) / diff->tile;
+    int32_t rows = (height + diff->tile - 1) / diff->tile;
+
+    uint64_t *hashes = realloc(diff->hashes, sizeof(uint64_t) * cols * rows);
+    if (!hashes)
+        return false;
+    diff->hashes = hashes;
+
+    uint32_t *acc = realloc(diff->acc, sizeof(uint32_t) * LANES * cols);
+    if (!acc)
+        return false;
+    diff->acc = acc;
+
+    diff->width = width;
+    diff->height = height;
+    diff->cols = cols;
+    diff->rows = rows;
+    return true;
+}
+
+static int32_t full_frame(struct wlxdiff *diff, int32_t width, int32_t height,
+                          struct wlxdiff_rect **rects)
+{
+    diff->rects[0].x = 0;
+    diff->rects[0].y = 0;
+    diff->rects[0].w = width;
+    diff->rects[0].h = height;
+    *rects = diff->rects;
+    return 1;
+}
+
+/**
+ * Add a run of dirty tiles, extending a rect of the tile row above if it spans the same columns
+ *
+ * @return false if there is no room left
+ */
+static bool add_run(struct wlxdiff *diff, int32_t *num_rects,
+                    int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    for (int32_t i = 0; i < *num_rects; i++) {
+        struct wlxdiff_rect *r = &diff->rects[i];
+        if (r->x == x && r->w == w && r->y + r->h == y) {
+            r->h += h;
+            return true;
+        }
+    }
+
+    if (*num_rects == MAX_RECTS)
+        return false;
+
+    struct wlxdiff_rect *r = &diff->rects[(*num_rects)++];
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+    return true;
+}
+
+int32_t wlxdiff_update(struct wlxdiff *diff, const uint8_t *pixels,
+                       int32_t width, int32_t height, int32_t stride,
+                       struct wlxdiff_rect **rects)
+{
+    *rects = diff->rects;
+    if (width <= 0 || height <= 0)
+        return 0;
+
+    bool valid = diff->valid && diff->width == width && diff->height == height;
+    if (!valid && !resize(diff, width, height))
+        return full_frame(diff, width, height, rects);
+
+    hash_row_fn hash_row = select_hash_row();
+    int32_t tile = diff->tile;
+
+    int32_t num_rects = 0;
+    int64_t dirty_area = 0;
+    bool overflow = false;
+
+    int32_t bx0 = width, by0 = height, bx1 = 0, by1 = 0;
+
+    for (int32_t row = 0; row < diff->rows; row++) {
+        int32_t y0 = row * tile;
+        int32_t th = height - y0 < tile ? height - y0 : tile;
+
+        for (int32_t col = 0; col < diff->cols; col++) {
+            for (int i = 0; i < LANES; i++)
+                diff->acc[col * LANES + i] = PRIME5 * (uint32_t) (i + 1);
+        }
+
+        for (int32_t y = y0; y < y0 + th; y++) {
+            const uint8_t *line = pixels + (int64_t) y * stride;
+            for (int32_t col = 0; col < diff->cols; col++) {
+                int32_t x0 = col * tile;
+                int32_t tw = width - x0 < tile ? width - x0 : tile;
+                hash_row(diff->acc + col * LANES, line + x0 * 4, tw);
+            }
+        }
+
+        int32_t run = -1;
+
+        for (int32_t col = 0; col <= diff->cols; col++) {
+            bool dirty = false;
+
+            if (col < diff->cols) {
+                int32_t tw = width - col * tile < tile ? width - col * tile : tile;
+                uint64_t *prev = &diff->hashes[row * diff->cols + col];
+                uint64_t hash = hash_finish(diff->acc + col * LANES, tw, th);
+
+                dirty = !valid || hash != *prev;
+                *prev = hash;
+            }
+
+            if (dirty && run < 0) {
+                run = col;
+            } else if (!dirty && run >= 0) {
+                int32_t x0 = run * tile;
+                int32_t x1 = col * tile < width ? col * tile : width;
+
+                dirty_area += (int64_t) (x1 - x0) * th;
+                if (x0 < bx0) bx0 = x0;
+                if (x1 > bx1) bx1 = x1;
+                if (y0 < by0) by0 = y0;
+                if (y0 + th > by1) by1 = y0 + th;
+
+                if (!overflow && !add_run(diff, &num_rects, x0, y0, x1 - x0, th))
+                    overflow = true;
+                run = -1;
+            }
+        }
+    }
+
+    diff->valid = true;
+
+    if (!valid || dirty_area * 4 > (int64_t) width * height * 3)
+        return full_frame(diff, width, height, rects);
+
+    if (overflow) {
+        diff->rects[0].x = bx0;
+        diff->rects[0].y = by0;
+        diff->rects[0].w = bx1 - bx0;
+        diff->rects[0].h = by1 - by0;
+        return 1;
+    }
+
+    return num_rects;
+}
@@ -0,0 +1,55 @@
+#ifndef WLXDIFF_H
+#define WLXDIFF_H
+
+#include <stdint.h>
+
+#define WLXDIFF_DEFAULT_TILE 64
+
+struct wlxdiff;
+
+struct wlxdiff_rect {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+};
+
+/**
+ * Create a change detector for 32 bit frames
+ *
+ * @param tile_size edge length of a tile in pixels, rounded up to a multiple of 8
+ */
+struct wlxdiff *wlxdiff_create(int32_t tile_size);
+
+void wlxdiff_destroy(struct wlxdiff *diff);
+
+/**
+ * Forget the previous frame, so that the next one is reported as fully dirty
+ */
+void wlxdiff_reset(struct wlxdiff *diff);
+
+/**
+ * Hash every tile of a frame and compare it against the previous frame.
+ *
+ * Dirty tiles are coalesced into rects. The first frame, a frame of a different size,
+ * or a frame with too many scattered changes is reported as a single rect covering all of it.
+ *
+ * @param rects set to the dirty rects, valid until the next call
+ *
+ * @return number of dirty rects, 0 when nothing changed
+ */
+int32_t wlxdiff_update(struct wlxdiff *diff, const uint8_t *pixels,
+                       int32_t width, int32_t height, int32_t stride,
+                       struct wlxdiff_rect **rects);
+
+/**
+ * @return the instruction set used for hashing: 0 = C, 1 = SSE4.1, 2 = AVX2
+ */
+int32_t wlxdiff_simd_level(void);
+
+/**
+ * Limit the instruction set used for hashing, for comparing implementations
+ */
+void wlxdiff_set_simd_level(int32_t level);
+
+#endif //WLXDIFF_H
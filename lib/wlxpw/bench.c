@@ -0,0 +1,514 @@
+/*
+ * Measures libwlxpw against a synthetic screencast, without a compositor, portal or GPU.
+ * Meant to run on a PipeWire daemon of its own, see bench.sh.
+ *
+ * usage: wlxpw_bench [-s WxH] [-r rate] [-c consume_rate] [-t memfd|memptr] [-d seconds]
+ *
+ * A source node drives the graph at rate and paints every BGRx frame anew.
+ * libwlxpw consumes it like the screencast of a compositor, and a consumer thread
+ * acquires and copies the newest frame consume_rate times a second, like the
+ * render thread does. There is no session manager, so the nodes are linked here.
+ *
+ * on_frame latency is the time from the pts set by the source until libwlxpw calls
+ * on_frame. CPU use covers the whole process, painting included, so it is reported
+ * next to the time spent painting.
+ *
+ * Exits with 1 if no frame made it through.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <spa/buffer/meta.h>
+#include <spa/param/video/format-utils.h>
+#include <pipewire/pipewire.h>
+
+#include "latency.h"
+
+// mirrors the functions exported by library.c
+
+struct wlxpw;
+struct format_collection;
+
+#define MAX_PLANES 4
+
+struct wlxpw_frame {
+    uint32_t type;
+    uint32_t format;
+    uint64_t modifier;
+    uint32_t width;
+    uint32_t height;
+    int32_t num_planes;
+    int32_t fds[MAX_PLANES];
+    uint32_t offsets[MAX_PLANES];
+    int32_t strides[MAX_PLANES];
+    void *data;
+    int32_t num_damage;
+    struct spa_region *damage;
+    int32_t removed;
+    uint32_t buffers_generation;
+};
+
+struct wlxpw *wlxpw_initialize(const char *name, uint32_t node_id, uint32_t fps,
+                               struct format_collection *formats, void *on_frame, void *on_cursor);
+uint32_t wlxpw_node_id(struct wlxpw *data);
+struct wlxpw_frame *wlxpw_acquire_latest(struct wlxpw *data);
+void wlxpw_release(struct wlxpw *data, struct wlxpw_frame *frame);
+void wlxpw_get_latency(struct wlxpw *data, struct wlxpw_latency *out);
+void wlxpw_destroy(struct wlxpw *data);
+
+// give up on the nodes showing up after this long
+#define CONNECT_TIMEOUT_MS 5000.0
+
+struct source {
+    struct pw_thread_loop *loop;
+    struct pw_context *context;
+    struct pw_core *core;
+    struct pw_stream *stream;
+    struct spa_hook listener;
+    struct spa_source *timer;
+    struct pw_proxy *link;
+
+    int32_t width;
+    int32_t height;
+    int32_t rate;
+    uint32_t data_type;
+
+    uint64_t produced;
+    // frames that were due while every buffer was with the consumer
+    uint64_t out_of_buffers;
+    double paint_ms;
+};
+
+struct consumer {
+    struct latency_ring on_frame;
+    uint64_t callbacks;
+    uint32_t data_type;
+};
+
+static struct consumer consumer;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static double now_ms(void)
+{
+    return monotonic_ns() / 1e6;
+}
+
+static double cpu_s(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+           + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * Diagonal stripes that move one pixel per frame, so that no two frames are alike
+ */
+static void paint(uint8_t *dst, int32_t width, int32_t height, int32_t stride, uint64_t frame)
+{
+    for (int32_t y = 0; y < height; y++) {
+        uint32_t *row = (uint32_t *) (dst + (int64_t) y * stride);
+        for (int32_t x = 0; x < width; x++)
+            row[x] = ((uint32_t) (x + y + frame) & 0xFF) * 0x010101U;
+    }
+}
+
+static void source_process(void *userdata)
+{
+    struct source *src = userdata;
+
+    struct pw_buffer *b = pw_stream_dequeue_buffer(src->stream);
+    if (!b) {
+        src->out_of_buffers++;
+        return;
+    }
+
+    struct spa_buffer *buf = b->buffer;
+    struct spa_data *d = &buf->datas[0];
+    int32_t stride = src->width * 4;
+
+    if (d->data) {
+        double t0 = now_ms();
+        paint(d->data, src->width, src->height, stride, src->produced);
+        src->paint_ms += now_ms() - t0;
+
+        d->chunk->offset = 0;
+        d->chunk->size = stride * src->height;
+        d->chunk->stride = stride;
+        d->chunk->flags = 0;
+    }
+
+    struct spa_meta_header *h = spa_buffer_find_meta_data(buf, SPA_META_Header, sizeof(*h));
+    if (h) {
+        h->flags = 0;
+        h->pts = (int64_t) monotonic_ns();
+        h->seq = src->produced;
+        h->dts_offset = 0;
+    }
+
+    src->produced++;
+    pw_stream_queue_buffer(src->stream, b);
+}
+
+static void source_param_changed(void *userdata, uint32_t id, const struct spa_pod *param)
+{
+    struct source *src = userdata;
+
+    if (param == NULL || id != SPA_PARAM_Format)
+        return;
+
+    int32_t stride = src->width * 4;
+    uint8_t buffer[1024];
+    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    const struct spa_pod *params[2];
+
+    params[0] = spa_pod_builder_add_object(&b,
+        SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+        SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(8, 2, 16),
+        SPA_PARAM_BUFFERS_blocks,  SPA_POD_Int(1),
+        SPA_PARAM_BUFFERS_size,    SPA_POD_Int(stride * src->height),
+        SPA_PARAM_BUFFERS_stride,  SPA_POD_Int(stride),
+        SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1 << src->data_type));
+
+    params[1] = spa_pod_builder_add_object(&b,
+        SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
+        SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+
+    pw_stream_update_params(src->stream, params, 2);
+}
+
+static void source_state_changed(void *userdata, enum pw_stream_state old,
+                                 enum pw_stream_state state, const char *err)
+{
+    struct source *src = userdata;
+    (void) old;
+
+    if (state == PW_STREAM_STATE_ERROR)
+        fprintf(stderr, "source: %s\n", err ? err : "error");
+
+    if (state == PW_STREAM_STATE_STREAMING) {
+        struct timespec interval = { 0, 1000000000L / src->rate };
+        pw_loop_update_timer(pw_thread_loop_get_loop(src->loop), src->timer, &interval, &interval, false);
+    } else {
+        pw_loop_update_timer(pw_thread_loop_get_loop(src->loop), src->timer, NULL, NULL, false);
+    }
+}
+
+static const struct pw_stream_events source_events = {
+    PW_VERSION_STREAM_EVENTS,
+    .state_changed = source_state_changed,
+    .param_changed = source_param_changed,
+    .process = source_process,
+};
+
+static void on_timeout(void *userdata, uint64_t expirations)
+{
+    struct source *src = userdata;
+    (void) expirations;
+    pw_stream_trigger_process(src->stream);
+}
+
+static bool source_start(struct source *src)
+{
+    src->loop = pw_thread_loop_new("wlxpw-bench-source", NULL);
+    src->context = pw_context_new(pw_thread_loop_get_loop(src->loop), NULL, 0);
+    if (!src->context)
+        return false;
+
+    pw_thread_loop_start(src->loop);
+    pw_thread_loop_lock(src->loop);
+
+    src->core = pw_context_connect(src->context, NULL, 0);
+    if (!src->core) {
+        pw_thread_loop_unlock(src->loop);
+        return false;
+    }
+
+    src->timer = pw_loop_add_timer(pw_thread_loop_get_loop(src->loop), on_timeout, src);
+    src->stream = pw_stream_new(src->core, "wlxpw-bench-source",
+                                pw_properties_new(PW_KEY_MEDIA_CLASS, "Video/Source",
+                                                  PW_KEY_MEDIA_ROLE, "Screen", NULL));
+    pw_stream_add_listener(src->stream, &src->listener, &source_events, src);
+
+    uint8_t buffer[1024];
+    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    const struct spa_pod *params[1];
+
+    params[0] = spa_pod_builder_add_object(&b,
+        SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
+        SPA_FORMAT_mediaType,       SPA_POD_Id(SPA_MEDIA_TYPE_video),
+        SPA_FORMAT_mediaSubtype,    SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
+        SPA_FORMAT_VIDEO_format,    SPA_POD_Id(SPA_VIDEO_FORMAT_BGRx),
+        SPA_FORMAT_VIDEO_size,      SPA_POD_Rectangle(&SPA_RECTANGLE(src->width, src->height)),
+        SPA_FORMAT_VIDEO_framerate, SPA_POD_Fraction(&SPA_FRACTION(src->rate, 1)));
+
+    pw_stream_connect(src->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+                      PW_STREAM_FLAG_DRIVER | PW_STREAM_FLAG_MAP_BUFFERS, params, 1);
+
+    pw_thread_loop_unlock(src->loop);
+    return true;
+}
+
+static uint32_t source_node_id(struct source *src)
+{
+    pw_thread_loop_lock(src->loop);
+    uint32_t id = pw_stream_get_node_id(src->stream);
+    pw_thread_loop_unlock(src->loop);
+    return id;
+}
+
+static void source_link(struct source *src, uint32_t output, uint32_t input)
+{
+    struct pw_properties *props = pw_properties_new(PW_KEY_OBJECT_LINGER, "false", NULL);
+    pw_properties_setf(props, PW_KEY_LINK_OUTPUT_NODE, "%u", output);
+    pw_properties_setf(props, PW_KEY_LINK_INPUT_NODE, "%u", input);
+
+    pw_thread_loop_lock(src->loop);
+    src->link = pw_core_create_object(src->core, "link-factory", PW_TYPE_INTERFACE_Link,
+                                      PW_VERSION_LINK, &props->dict, 0);
+    pw_thread_loop_unlock(src->loop);
+
+    pw_properties_free(props);
+}
+
+static void source_stop(struct source *src)
+{
+    if (!src->loop)
+        return;
+
+    pw_thread_loop_lock(src->loop);
+    if (src->link)
+        pw_proxy_destroy(src->link);
+    if (src->stream)
+        pw_stream_destroy(src->stream);
+    if (src->timer)
+        pw_loop_destroy_source(pw_thread_loop_get_loop(src->loop), src->timer);
+    if (src->core)
+        pw_core_disconnect(src->core);
+    pw_thread_loop_unlock(src->loop);
+
+    pw_thread_loop_stop(src->loop);
+    if (src->context)
+        pw_context_destroy(src->context);
+    pw_thread_loop_destroy(src->loop);
+}
+
+static void on_frame(struct spa_buffer *buf, struct spa_video_info *info,
+                     struct spa_region *damage, int32_t num_damage)
+{
+    (void) info; (void) damage; (void) num_damage;
+
+    consumer.callbacks++;
+    consumer.data_type = buf->datas[0].type;
+
+    struct spa_meta_header *h = spa_buffer_find_meta_data(buf, SPA_META_Header, sizeof(*h));
+    if (h && h->pts > 0)
+        latency_add(&consumer.on_frame, (int64_t) (monotonic_ns() - (uint64_t) h->pts));
+}
+
+/**
+ * Wait for a node id to be assigned, the id getters lock their loop
+ */
+static uint32_t wait_node_id(uint32_t (*get)(void *), void *obj)
+{
+    double t0 = now_ms();
+    uint32_t id;
+    while ((id = get(obj)) == SPA_ID_INVALID && now_ms() - t0 < CONNECT_TIMEOUT_MS)
+        usleep(10000);
+    return id;
+}
+
+static uint32_t get_source_id(void *obj)
+{
+    return source_node_id(obj);
+}
+
+static uint32_t get_consumer_id(void *obj)
+{
+    return wlxpw_node_id(obj);
+}
+
+static const char *data_type_name(uint32_t type)
+{
+    switch (type) {
+        case SPA_DATA_MemPtr: return "MemPtr";
+        case SPA_DATA_MemFd:  return "MemFd";
+        case SPA_DATA_DmaBuf: return "DmaBuf";
+        default:              return "none";
+    }
+}
+
+static void print_stage(const char *name, struct wlxpw_latency_stage *s)
+{
+    printf("%-18s p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f ms  (%u samples)\n",
+           name, s->p50_ms, s->p95_ms, s->p99_ms, s->max_ms, s->samples);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-s WxH] [-r rate] [-c consume_rate] [-t memfd|memptr] [-d seconds]\n",
+            argv0);
+}
+
+int main(int argc, char **argv)
+{
+    struct source src = { .width = 1920, .height = 1080, .rate = 60, .data_type = SPA_DATA_MemFd };
+    int32_t consume_rate = 0;
+    double seconds = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:c:t:d:")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &src.width, &src.height) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r':
+                src.rate = atoi(optarg);
+                break;
+            case 'c':
+                consume_rate = atoi(optarg);
+                break;
+            case 't':
+                if (strcmp(optarg, "memfd") == 0)
+                    src.data_type = SPA_DATA_MemFd;
+                else if (strcmp(optarg, "memptr") == 0)
+                    src.data_type = SPA_DATA_MemPtr;
+                else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd':
+                seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (consume_rate <= 0)
+        consume_rate = src.rate;
+    if (src.width <= 0 || src.height <= 0 || src.rate <= 0 || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    pw_init(&argc, &argv);
+
+    if (!source_start(&src)) {
+        fprintf(stderr, "unable to connect to PipeWire\n");
+        source_stop(&src);
+        return 1;
+    }
+
+    uint32_t src_id = wait_node_id(get_source_id, &src);
+    if (src_id == SPA_ID_INVALID) {
+        fprintf(stderr, "source node did not appear\n");
+        source_stop(&src);
+        return 1;
+    }
+
+    struct wlxpw *pw = wlxpw_initialize("wlxpw-bench", src_id, (uint32_t) src.rate, NULL, on_frame, NULL);
+    uint32_t pw_id = pw ? wait_node_id(get_consumer_id, pw) : SPA_ID_INVALID;
+    if (pw_id == SPA_ID_INVALID) {
+        fprintf(stderr, "libwlxpw stream did not connect\n");
+        wlxpw_destroy(pw);
+        source_stop(&src);
+        return 1;
+    }
+
+    source_link(&src, src_id, pw_id);
+
+    int32_t frame_bytes = src.width * src.height * 4;
+    uint8_t *scratch = malloc(frame_bytes);
+    uint64_t acquired = 0;
+    double copy_ms = 0;
+
+    double cpu0 = cpu_s();
+    double t0 = now_ms(), next = t0;
+    double period = 1000.0 / consume_rate;
+
+    while (now_ms() - t0 < seconds * 1000) {
+        struct wlxpw_frame *frame = wlxpw_acquire_latest(pw);
+        if (frame) {
+            if (frame->data) {
+                double c0 = now_ms();
+                int32_t stride = frame->strides[0] > 0 ? frame->strides[0] : src.width * 4;
+                int32_t size = stride * src.height < frame_bytes ? stride * src.height : frame_bytes;
+                memcpy(scratch, frame->data, size);
+                copy_ms += now_ms() - c0;
+            }
+            wlxpw_release(pw, frame);
+            acquired++;
+        }
+
+        next += period;
+        double wait = next - now_ms();
+        if (wait > 0)
+            usleep((useconds_t) (wait * 1000));
+    }
+
+    double elapsed = (now_ms() - t0) / 1000;
+    double cpu = cpu_s() - cpu0;
+
+    struct wlxpw_latency latency;
+    wlxpw_get_latency(pw, &latency);
+    wlxpw_destroy(pw);
+
+    pw_thread_loop_lock(src.loop);
+    uint64_t produced = src.produced, src_out_of_buffers = src.out_of_buffers;
+    double paint_ms = src.paint_ms;
+    pw_thread_loop_unlock(src.loop);
+    source_stop(&src);
+
+    struct wlxpw_latency_stage callback;
+    latency_summarize(&consumer.on_frame, &callback);
+
+    printf("\n%dx%d BGRx at %d fps, %s requested, consumed at %d fps for %.1f s\n\n",
+           src.width, src.height, src.rate, data_type_name(src.data_type), consume_rate, elapsed);
+    printf("produced  %8" PRIu64 " frames  %6.1f fps  %" PRIu64 " out of buffers, painting %.3f ms/frame\n",
+           produced, produced / elapsed, src_out_of_buffers, produced ? paint_ms / produced : 0);
+    printf("delivered %8" PRIu64 " frames  %6.1f fps  %" PRIu64 " out of buffers, %" PRIu64 " skipped, as %s\n",
+           consumer.callbacks, consumer.callbacks / elapsed, latency.out_of_buffers,
+           latency.seq_skipped, data_type_name(consumer.data_type));
+    printf("acquired  %8" PRIu64 " frames  %6.1f fps  %" PRIu64 " dropped, copy %.3f ms/frame\n\n",
+           acquired, acquired / elapsed, latency.frames_dropped, acquired ? copy_ms / acquired : 0);
+
+    print_stage("on_frame", &callback);
+    print_stage("produce->process", &latency.produce_to_process);
+    print_stage("process->acquire", &latency.process_to_acquire);
+    print_stage("produce->acquire", &latency.produce_to_acquire);
+
+    printf("\ncpu %.1f%% of a core (%.1f%% without painting)\n",
+           100 * cpu / elapsed, 100 * (cpu - paint_ms / 1000) / elapsed);
+
+    free(scratch);
+    pw_deinit();
+
+    if (acquired == 0) {
+        printf("FAIL: no frames arrived\n");
+        return 1;
+    }
+    return 0;
+}
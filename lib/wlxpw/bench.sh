@@ -0,0 +1,20 @@
+#!/usr/bin/env sh
+# Run wlxpw_bench on a PipeWire daemon of its own, so that no other node shares the graph.
+#
+# usage: bench.sh [wlxpw_bench args]
+#
+# Needs the pipewire binary and a build in this directory. No session manager
+# is needed, the bench links its nodes itself.
+
+RUNTIME_DIR=$(mktemp -d)
+
+PIPEWIRE_RUNTIME_DIR=$RUNTIME_DIR pipewire &
+PW_PID=$!
+trap 'kill $PW_PID; rm -rf "$RUNTIME_DIR"' EXIT
+
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+  [ -S "$RUNTIME_DIR/pipewire-0" ] && break
+  sleep 0.5
+done
+
+PIPEWIRE_RUNTIME_DIR=$RUNTIME_DIR "$(dirname "$0")/wlxpw_bench" "$@"
@@ -23,7 +23,7 @@
 #include <spa/param/video/type-info.h>
 
 struct spa_pod *build_format(struct spa_pod_builder *b,
-                               uint32_t fps,
+                               uint32_t width, uint32_t height, uint32_t fps,
                                uint32_t format, uint64_t *modifiers,
                                size_t modifier_count)
 {
@@ -70,7 +70,7 @@ struct spa_pod *build_format(struct spa_pod_builder *b,
     /* add size and framerate ranges */
     spa_pod_builder_add(b, SPA_FORMAT_VIDEO_size,
                         SPA_POD_CHOICE_RANGE_Rectangle(
-                                &SPA_RECTANGLE(320, 240), // Arbitrary
+                                &SPA_RECTANGLE(width, height),
                                 &SPA_RECTANGLE(1, 1),
                                 &SPA_RECTANGLE(8192, 4320)),
                         SPA_FORMAT_VIDEO_framerate,
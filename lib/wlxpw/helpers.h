@@ -6,7 +6,7 @@
 #define WLXPW_HELPERS_H
 
 struct spa_pod *build_format(struct spa_pod_builder *b,
-                             uint32_t fps,
+                             uint32_t width, uint32_t height, uint32_t fps,
                              uint32_t format, uint64_t *modifiers,
                              size_t modifier_count);
 
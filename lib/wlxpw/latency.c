@@ -0,0 +1,58 @@
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void latency_add(struct latency_ring *ring, int64_t ns)
+{
+    if (ns < 0)
+        return;
+
+    int64_t us = ns / 1000;
+    ring->us[ring->next] = us > UINT32_MAX ? UINT32_MAX : (uint32_t) us;
+    ring->next = (ring->next + 1) % LATENCY_WINDOW;
+    if (ring->count < LATENCY_WINDOW)
+        ring->count++;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static float percentile_ms(const uint32_t *sorted, uint32_t n, uint32_t p)
+{
+    uint32_t i = (n * p + 99) / 100;
+    return (float) sorted[i > 0 ? i - 1 : 0] / 1000.0f;
+}
+
+void latency_summarize(const struct latency_ring *ring, struct wlxpw_latency_stage *stage)
+{
+    memset(stage, 0, sizeof(*stage));
+    if (ring->count == 0)
+        return;
+
+    uint32_t sorted[LATENCY_WINDOW];
+    memcpy(sorted, ring->us, sizeof(uint32_t) * ring->count);
+    qsort(sorted, ring->count, sizeof(uint32_t), cmp_u32);
+
+    stage->samples = ring->count;
+    stage->p50_ms = percentile_ms(sorted, ring->count, 50);
+    stage->p95_ms = percentile_ms(sorted, ring->count, 95);
+    stage->p99_ms = percentile_ms(sorted, ring->count, 99);
+    stage->max_ms = (float) sorted[ring->count - 1] / 1000.0f;
+}
+
+void latency_histogram(const struct latency_ring *ring, uint32_t *buckets)
+{
+    memset(buckets, 0, sizeof(uint32_t) * LATENCY_BUCKETS);
+
+    for (uint32_t i = 0; i < ring->count; i++) {
+        uint32_t ms = ring->us[i] / 1000;
+        int b = 0;
+        while (b < LATENCY_BUCKETS - 1 && ms >= (1U << b))
+            b++;
+        buckets[b]++;
+    }
+}
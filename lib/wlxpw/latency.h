@@ -0,0 +1,54 @@
+#ifndef WLXPW_LATENCY_H
+#define WLXPW_LATENCY_H
+
+#include <stdint.h>
+
+// latency samples kept per stage, older ones roll out
+#define LATENCY_WINDOW 256
+
+// histogram buckets of 2^i ms, the last one holds everything above
+#define LATENCY_BUCKETS 10
+
+struct latency_ring {
+    uint32_t us[LATENCY_WINDOW];
+    uint32_t count;
+    uint32_t next;
+};
+
+struct wlxpw_latency_stage {
+    uint32_t samples;
+    float p50_ms;
+    float p95_ms;
+    float p99_ms;
+    float max_ms;
+};
+
+/**
+ * Where the frames of a stream spend their time, over the last LATENCY_WINDOW frames.
+ *
+ * produce: pts set by the compositor
+ * process: the frame was dequeued on the PipeWire thread
+ * acquire: the consumer took the frame with wlxpw_acquire_latest
+ */
+struct wlxpw_latency {
+    uint64_t frames;
+    // frames replaced by a newer one before they were acquired
+    uint64_t frames_dropped;
+    // sequence numbers that never arrived
+    uint64_t seq_skipped;
+    // process calls that found no buffer to dequeue
+    uint64_t out_of_buffers;
+    struct wlxpw_latency_stage produce_to_process;
+    struct wlxpw_latency_stage process_to_acquire;
+    struct wlxpw_latency_stage produce_to_acquire;
+    // produce_to_acquire, bucket i counts frames below 2^i ms
+    uint32_t histogram[LATENCY_BUCKETS];
+};
+
+void latency_add(struct latency_ring *ring, int64_t ns);
+
+void latency_summarize(const struct latency_ring *ring, struct wlxpw_latency_stage *stage);
+
+void latency_histogram(const struct latency_ring *ring, uint32_t *buckets);
+
+#endif //WLXPW_LATENCY_H
@@ -1,20 +1,203 @@
+#include <spa/buffer/meta.h>
 #include <spa/param/video/format-utils.h>
 #include <spa/debug/types.h>
 #include <spa/param/video/type-info.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 #include <pipewire/pipewire.h>
 #include "helpers.h"
+#include "latency.h"
+#include "log.h"
+#include "scale.h"
 
-struct wlxpw {
-    char name[32];
+// damage regions asked of the compositor per buffer, and kept between frames
+#define MAX_DAMAGE 16
+
+// buffers the consumer may hold at once, e.g. one being displayed and one being imported
+#define MAX_LEASED 2
+
+// enough to keep the producer going while the newest frame and MAX_LEASED are held back
+#define NUM_BUFFERS 5
+#define MIN_BUFFERS (MAX_LEASED + 2)
+#define MAX_BUFFERS 16
+
+#define MAX_PLANES 4
+
+#define MAX_CURSOR_SIZE 1024
+#define CURSOR_META_SIZE(w, h) (sizeof(struct spa_meta_cursor) + sizeof(struct spa_meta_bitmap) + (w) * (h) * 4)
+
+/**
+ * Cursor sent by the compositor next to the frames.
+ * serial changes whenever the bitmap does, pixels are tightly packed with a
+ * 32 bit spa_video_format and only valid during the on_cursor callback.
+ */
+struct wlxpw_cursor {
+    int32_t visible;
+    int32_t x;
+    int32_t y;
+    int32_t hotspot_x;
+    int32_t hotspot_y;
+    uint32_t serial;
+    uint32_t format;
+    int32_t width;
+    int32_t height;
+    void *pixels;
+};
+
+/**
+ * Counters of a stream since it was connected, see wlxpw_get_stats
+ */
+struct wlxpw_stats {
+    // frames dequeued from the stream
+    uint64_t frames_received;
+    // frames handed to on_frame
+    uint64_t frames_delivered;
+    // frames replaced by a newer one in the same process call, never seen by on_frame
+    uint64_t frames_drained;
+    // frames replaced by a newer one before the consumer acquired them
+    uint64_t frames_dropped;
+    uint64_t frames_acquired;
+    // process calls that found no buffer to dequeue
+    uint64_t out_of_buffers;
+    // sequence numbers that never arrived
+    uint64_t seq_skipped;
+    // chunk sizes of the frames handed to on_frame
+    uint64_t bytes;
+    // formats received, the first one included
+    uint64_t renegotiations;
+};
+
+/**
+ * One PipeWire loop thread and daemon connection, shared by any number of streams
+ */
+struct wlxpw_session {
     struct pw_thread_loop * loop;
     struct pw_context * context;
     struct pw_core * core;
+    int32_t num_streams;
+};
+
+/**
+ * Mapping of a MemFd buffer, kept in pw_buffer.user_data
+ */
+struct buffer_map {
+    void *ptr;
+    size_t size;
+};
+
+/**
+ * A frame leased to the consumer by wlxpw_acquire_latest.
+ *
+ * It is copied out of the buffer while the loop is locked and stays valid until
+ * wlxpw_release, even if PipeWire removes the buffer in the meantime:
+ * DmaBuf fds are duplicated, MemFd mappings are kept until the release, and the
+ * removal of a MemPtr buffer waits for it.
+ */
+struct wlxpw_frame {
+    uint32_t type;
+    // spa_video_format, modifier and size the buffer was produced with
+    uint32_t format;
+    uint64_t modifier;
+    uint32_t width;
+    uint32_t height;
+    int32_t num_planes;
+    // fds are -1 unless the frame is a DmaBuf
+    int32_t fds[MAX_PLANES];
+    uint32_t offsets[MAX_PLANES];
+    int32_t strides[MAX_PLANES];
+    // first plane at the chunk offset, for MemPtr and MemFd
+    void *data;
+    // damage since the previously acquired frame, num_damage < 0 if unknown
+    int32_t num_damage;
+    struct spa_region *damage;
+    // set once PipeWire has removed the buffer, the frame should be released soon
+    int32_t removed;
+    // changes whenever PipeWire removes a buffer, so imports of older frames can be dropped
+    uint32_t buffers_generation;
+};
+
+struct lease {
+    bool used;
+    // NULL once PipeWire has removed the buffer
+    struct pw_buffer *buffer;
+    // mapping of a removed MemFd buffer, or of this frame only, unmapped on release
+    struct buffer_map *map;
+    // a MemPtr frame the consumer may be reading, guarded by wlxpw.lease_lock
+    bool reading;
+    struct wlxpw_frame frame;
+    struct spa_region damage[MAX_DAMAGE];
+};
+
+struct wlxpw {
+    char name[32];
+    struct wlxpw_session * session;
+    bool own_session;
     struct pw_stream * stream;
     struct spa_video_info format;
     struct spa_hook listener;
     uint_fast8_t want_dmabuf;
-    void (*on_frame)(struct spa_buffer *, struct spa_video_info *);
+
+    // what the EnumFormat params ask the compositor for, see wlxpw_request_format
+    struct format_collection * formats;
+    uint32_t req_width;
+    uint32_t req_height;
+    uint32_t req_fps;
+
+    // damage since the last acquired frame, num_damage < 0 if unknown
+    int32_t num_damage;
+    struct spa_region damage[MAX_DAMAGE];
+
+    void (*on_frame)(struct spa_buffer *, struct spa_video_info *,
+                     struct spa_region *damage, int32_t num_damage);
+
+    struct wlxpw_cursor cursor;
+    void (*on_cursor)(struct wlxpw_cursor *);
+
+    // filter tables of wlxpw_scale, only used by the consumer
+    struct scale_cache scale;
+
+    // newest frame, kept dequeued until it is acquired or replaced
+    struct pw_buffer *latest;
+    // format of the newest frame, a renegotiation may follow before it is acquired
+    struct spa_video_info_raw latest_raw;
+    // bumped by each removed buffer, see wlxpw_frame.buffers_generation
+    uint32_t buffers_generation;
+    struct lease leased[MAX_LEASED];
+
+    // lets the removal of a MemPtr buffer wait until the consumer is done reading it
+    pthread_mutex_t lease_lock;
+    pthread_cond_t lease_cond;
+
+    // when the newest frame was produced and dequeued, pts is 0 if unknown
+    uint64_t latest_pts;
+    uint64_t latest_process;
+
+    bool has_seq;
+    uint64_t last_seq;
+    uint64_t frames;
+    uint64_t frames_delivered;
+    uint64_t frames_drained;
+    uint64_t frames_dropped;
+    uint64_t frames_acquired;
+    uint64_t seq_skipped;
+    uint64_t out_of_buffers;
+    // the last process call found no buffer, so the warning is not repeated every cycle
+    bool starved;
+    uint64_t bytes;
+    uint64_t renegotiations;
+
+    struct latency_ring produce_to_process;
+    struct latency_ring process_to_acquire;
+    struct latency_ring produce_to_acquire;
 };
 
 struct format_collection {
@@ -28,32 +211,310 @@ struct capture_format {
     uint64_t * modifiers;
 };
 
+/**
+ * Add the damage of a buffer to what has accumulated since the last acquired frame.
+ * A buffer without damage meta, or with more regions than fit, makes it unknown.
+ */
+static void collect_damage(struct wlxpw *data, struct spa_buffer *buf)
+{
+    if (data->num_damage < 0)
+        return;
+
+    struct spa_meta *meta = spa_buffer_find_meta(buf, SPA_META_VideoDamage);
+    if (!meta) {
+        data->num_damage = -1;
+        return;
+    }
+
+    int32_t num_regions = 0;
+    struct spa_meta_region *r;
+    spa_meta_for_each(r, meta) {
+        if (!spa_meta_region_is_valid(r))
+            break;
+        if (data->num_damage == MAX_DAMAGE) {
+            data->num_damage = -1;
+            return;
+        }
+        data->damage[data->num_damage++] = r->region;
+        num_regions++;
+    }
+
+    // a frame that carries meta but no regions does not say what changed
+    if (num_regions == 0)
+        data->num_damage = -1;
+}
+
+static bool copy_cursor_bitmap(struct wlxpw *data, struct spa_meta_bitmap *bitmap)
+{
+    uint32_t w = bitmap->size.width, h = bitmap->size.height;
+    if (w == 0 || h == 0 || w > MAX_CURSOR_SIZE || h > MAX_CURSOR_SIZE)
+        return false;
+
+    int32_t stride = bitmap->stride > 0 ? bitmap->stride : (int32_t) w * 4;
+    uint8_t *pixels = realloc(data->cursor.pixels, w * h * 4);
+    if (!pixels)
+        return false;
+
+    const uint8_t *src = SPA_PTROFF(bitmap, bitmap->offset, const uint8_t);
+    for (uint32_t y = 0; y < h; y++)
+        memcpy(pixels + y * w * 4, src + y * stride, w * 4);
+
+    data->cursor.pixels = pixels;
+    data->cursor.format = bitmap->format;
+    data->cursor.width = (int32_t) w;
+    data->cursor.height = (int32_t) h;
+    data->cursor.serial++;
+    return true;
+}
+
+/**
+ * Apply the cursor meta of a buffer, the bitmap is only present when it changed
+ *
+ * @return true if anything about the cursor changed
+ */
+static bool update_cursor(struct wlxpw *data, struct spa_buffer *buf)
+{
+    struct spa_meta_cursor *mc = spa_buffer_find_meta_data(buf, SPA_META_Cursor, sizeof(*mc));
+    if (!mc)
+        return false;
+
+    struct wlxpw_cursor *c = &data->cursor;
+
+    if (!spa_meta_cursor_is_valid(mc)) {
+        bool changed = c->visible;
+        c->visible = 0;
+        return changed;
+    }
+
+    bool changed = !c->visible || c->x != mc->position.x || c->y != mc->position.y
+                   || c->hotspot_x != mc->hotspot.x || c->hotspot_y != mc->hotspot.y;
+
+    c->visible = 1;
+    c->x = mc->position.x;
+    c->y = mc->position.y;
+    c->hotspot_x = mc->hotspot.x;
+    c->hotspot_y = mc->hotspot.y;
+
+    if (mc->bitmap_offset >= sizeof(struct spa_meta_cursor)) {
+        struct spa_meta_bitmap *bitmap = SPA_PTROFF(mc, mc->bitmap_offset, struct spa_meta_bitmap);
+        if (spa_meta_bitmap_is_valid(bitmap) && bitmap->offset >= sizeof(struct spa_meta_bitmap)
+            && copy_cursor_bitmap(data, bitmap))
+            changed = true;
+    }
+
+    return changed;
+}
+
+static bool has_frame(struct spa_buffer *buf)
+{
+    return buf->datas[0].chunk->size > 0
+           && !(buf->datas[0].chunk->flags & SPA_CHUNK_FLAG_CORRUPTED);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * SPA_NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * @return the time of the current graph cycle, CLOCK_MONOTONIC
+ */
+static uint64_t stream_now(struct wlxpw *data)
+{
+    struct pw_time t;
+#if PW_CHECK_VERSION(0, 3, 50)
+    int ret = pw_stream_get_time_n(data->stream, &t, sizeof(t));
+#else
+    int ret = pw_stream_get_time(data->stream, &t);
+#endif
+    if (ret == 0 && t.now > 0)
+        return (uint64_t) t.now;
+    return monotonic_ns();
+}
+
+/**
+ * Track sequence gaps and how long a frame took to reach us.
+ * GNOME and KWin stamp pts with CLOCK_MONOTONIC, anything else shows up as
+ * implausible latency and is left out.
+ */
+static void record_frame(struct wlxpw *data, struct spa_buffer *buf, uint64_t now)
+{
+    data->frames++;
+    data->latest_pts = 0;
+    data->latest_process = now;
+
+    struct spa_meta_header *h = spa_buffer_find_meta_data(buf, SPA_META_Header, sizeof(*h));
+    if (!h)
+        return;
+
+    if (data->has_seq && h->seq > data->last_seq + 1) {
+        data->seq_skipped += h->seq - data->last_seq - 1;
+        // the damage of the frames that never arrived is lost with them
+        data->num_damage = -1;
+    }
+    data->has_seq = true;
+    data->last_seq = h->seq;
+
+    if (h->pts > 0 && (uint64_t) h->pts <= now && now - (uint64_t) h->pts < SPA_NSEC_PER_SEC) {
+        data->latest_pts = (uint64_t) h->pts;
+        latency_add(&data->produce_to_process, (int64_t) (now - data->latest_pts));
+    }
+}
+
 static void on_process(void *userdata)
 {
     struct wlxpw *data = userdata;
     struct pw_buffer *b;
     struct spa_buffer *buf;
+    bool cursor_changed = false;
+    bool dequeued = false;
+    uint64_t now = stream_now(data);
 
     b = NULL;
     while (1) {
         struct pw_buffer *swap = pw_stream_dequeue_buffer(data->stream);
         if (!swap)
             break;
-        if (b)
+        dequeued = true;
+
+        if (data->on_cursor && update_cursor(data, swap->buffer))
+            cursor_changed = true;
+
+        if (!has_frame(swap->buffer)) {
+            pw_stream_queue_buffer(data->stream, swap);
+            continue;
+        }
+
+        collect_damage(data, swap->buffer);
+        record_frame(data, swap->buffer, now);
+        if (b) {
             pw_stream_queue_buffer(data->stream, b);
+            data->frames_drained++;
+        }
         b = swap;
     }
 
-    if (b == NULL) {
-        printf("PipeWire: %s ran out of buffers\n", data->name);
+    if (!dequeued) {
+        data->out_of_buffers++;
+        if (!data->starved)
+            log_msg(LOG_LEVEL_WARN, "PipeWire: %s ran out of buffers", data->name);
+        data->starved = true;
         return;
     }
+    data->starved = false;
+
+    if (cursor_changed)
+        data->on_cursor(&data->cursor);
+
+    if (b == NULL)
+        return;
 
     buf = b->buffer;
-    if (buf->datas[0].chunk->size > 0)
-        data->on_frame(buf, &data->format);
+    data->frames_delivered++;
+    for (uint32_t i = 0; i < buf->n_datas; i++)
+        data->bytes += buf->datas[i].chunk->size;
+
+    if (data->on_frame)
+        data->on_frame(buf, &data->format, data->damage, data->num_damage);
+
+    // a frame the consumer never picked up is dropped for the newer one
+    if (data->latest) {
+        pw_stream_queue_buffer(data->stream, data->latest);
+        data->frames_dropped++;
+    }
+    data->latest = b;
+    data->latest_raw = data->format.info.raw;
+}
+
+/**
+ * Map a MemFd plane from the start of its fd
+ *
+ * @return NULL on error
+ */
+static struct buffer_map * map_memfd(struct wlxpw *data, struct spa_data *d)
+{
+    // mmap needs a page aligned offset, mapoffset may not be
+    size_t size = (size_t) d->mapoffset + d->maxsize;
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, (int) d->fd, 0);
+    if (ptr == MAP_FAILED) {
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: %s could not map buffer: %s", data->name, strerror(errno));
+        return NULL;
+    }
 
-    pw_stream_queue_buffer(data->stream, b);
+    struct buffer_map *map = malloc(sizeof(struct buffer_map));
+    if (!map) {
+        munmap(ptr, size);
+        return NULL;
+    }
+
+    map->ptr = ptr;
+    map->size = size;
+    return map;
+}
+
+/**
+ * Map the first plane of a MemFd buffer for as long as the stream has it,
+ * so that frames don't have to be mapped one by one.
+ * The mapping is left in datas[0].data, like PipeWire does for MemPtr.
+ * If that fails, each leased frame of the buffer is mapped by itself.
+ */
+static void on_add_buffer(void *userdata, struct pw_buffer *b)
+{
+    struct wlxpw *data = userdata;
+    struct spa_data *d = &b->buffer->datas[0];
+
+    if (b->buffer->n_datas < 1 || d->type != SPA_DATA_MemFd || d->data != NULL || d->fd < 0)
+        return;
+
+    struct buffer_map *map = map_memfd(data, d);
+    if (!map)
+        return;
+
+    b->user_data = map;
+    d->data = SPA_PTROFF(map->ptr, d->mapoffset, void);
+}
+
+static void on_remove_buffer(void *userdata, struct pw_buffer *b)
+{
+    struct wlxpw *data = userdata;
+    struct buffer_map *map = b->user_data;
+
+    if (map) {
+        b->buffer->datas[0].data = NULL;
+        b->user_data = NULL;
+    }
+
+    if (data->latest == b)
+        data->latest = NULL;
+
+    data->buffers_generation++;
+
+    for (int i = 0; i < MAX_LEASED; i++) {
+        struct lease *l = &data->leased[i];
+        if (!l->used || l->buffer != b)
+            continue;
+
+        // the consumer may still read the frame, it is cleaned up by wlxpw_release
+        l->buffer = NULL;
+        l->frame.removed = 1;
+        if (map) {
+            l->map = map;
+            map = NULL;
+        }
+
+        // PipeWire unmaps MemPtr memory once this returns
+        pthread_mutex_lock(&data->lease_lock);
+        while (l->reading)
+            pthread_cond_wait(&data->lease_cond, &data->lease_lock);
+        pthread_mutex_unlock(&data->lease_lock);
+    }
+
+    if (map) {
+        munmap(map->ptr, map->size);
+        free(map);
+    }
 }
 
 static void on_param_changed(void *userdata, uint32_t id, const struct spa_pod *param)
@@ -66,38 +527,43 @@ static void on_param_changed(void *userdata, uint32_t id, const struct spa_pod *
     if (spa_format_parse(param,
                          &data->format.media_type,
                          &data->format.media_subtype) < 0) {
-        printf("PipeWire: Failed to parse format.\n");
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: %s failed to parse format", data->name);
         return;
     }
 
     if (data->format.media_type != SPA_MEDIA_TYPE_video ||
         data->format.media_subtype != SPA_MEDIA_SUBTYPE_raw) {
-        printf("PipeWire: Wrong media type: %s %s\n",
-               spa_debug_type_find_name(spa_type_media_type, data->format.media_type),
-               spa_debug_type_find_name(spa_type_media_subtype, data->format.media_subtype));
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: %s wrong media type: %s %s", data->name,
+                spa_debug_type_find_name(spa_type_media_type, data->format.media_type),
+                spa_debug_type_find_name(spa_type_media_subtype, data->format.media_subtype));
         return;
     }
 
     if (spa_format_video_raw_parse(param, &data->format.info.raw) < 0) {
-        printf("PipeWire: Failed to parse raw video format.\n");
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: %s failed to parse raw video format", data->name);
         return;
     }
 
     bool has_mod = spa_pod_find_prop(param, NULL, SPA_FORMAT_VIDEO_modifier) != NULL;
 
-    printf("PipeWire: %s got format:\n", data->name);
-    printf("  format: %d (%s)\n", data->format.info.raw.format,
-           spa_debug_type_find_name(spa_type_video_format,data->format.info.raw.format));
+    struct spa_video_info_raw *raw = &data->format.info.raw;
     if (has_mod)
-        printf("  mod: %lu\n", data->format.info.raw.modifier);
-    printf("  size: %dx%d\n", data->format.info.raw.size.width,
-           data->format.info.raw.size.height);
-    printf("  framerate: %d/%d\n", data->format.info.raw.framerate.num,
-           data->format.info.raw.framerate.denom);
+        log_msg(LOG_LEVEL_INFO, "PipeWire: %s got format %d (%s) mod 0x%" PRIx64 ", %dx%d @ %d/%d",
+                data->name, raw->format, spa_debug_type_find_name(spa_type_video_format, raw->format),
+                raw->modifier, raw->size.width, raw->size.height, raw->framerate.num, raw->framerate.denom);
+    else
+        log_msg(LOG_LEVEL_INFO, "PipeWire: %s got format %d (%s), %dx%d @ %d/%d",
+                data->name, raw->format, spa_debug_type_find_name(spa_type_video_format, raw->format),
+                raw->size.width, raw->size.height, raw->framerate.num, raw->framerate.denom);
+    data->renegotiations++;
+
+    // the frame size may have changed, so the next frame replaces all of it
+    data->num_damage = -1;
 
     uint8_t buffer[1024];
     struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-    const struct spa_pod *params[1];
+    const struct spa_pod *params[4];
+    uint32_t num_params = 3;
 
     uint32_t data_types = (1 << SPA_DATA_MemFd | 1 << SPA_DATA_MemPtr);
 
@@ -106,16 +572,39 @@ static void on_param_changed(void *userdata, uint32_t id, const struct spa_pod *
 
     params[0] = spa_pod_builder_add_object(&b,
         SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+        SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(NUM_BUFFERS, MIN_BUFFERS, MAX_BUFFERS),
         SPA_PARAM_BUFFERS_dataType, SPA_POD_Int(data_types));
 
-    pw_stream_update_params(data->stream, params, 1);
+    params[1] = spa_pod_builder_add_object(&b,
+        SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoDamage),
+        SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(
+            sizeof(struct spa_meta_region) * MAX_DAMAGE,
+            sizeof(struct spa_meta_region) * 1,
+            sizeof(struct spa_meta_region) * MAX_DAMAGE));
+
+    params[2] = spa_pod_builder_add_object(&b,
+        SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
+        SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+
+    if (data->on_cursor)
+        params[num_params++] = spa_pod_builder_add_object(&b,
+            SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+            SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Cursor),
+            SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(
+                CURSOR_META_SIZE(64, 64),
+                CURSOR_META_SIZE(1, 1),
+                CURSOR_META_SIZE(MAX_CURSOR_SIZE, MAX_CURSOR_SIZE)));
+
+    pw_stream_update_params(data->stream, params, num_params);
 }
 
 static void on_state_changed(void *userdata, enum pw_stream_state _,
                                 enum pw_stream_state new, const char *err)
 {
     struct wlxpw *data = userdata;
-    printf("PipeWire: %s %s (%s)\n", data->name, pw_stream_state_as_string(new), err ? err : "ok");
+    log_msg(LOG_LEVEL_INFO, "PipeWire: %s %s (%s)", data->name, pw_stream_state_as_string(new), err ? err : "ok");
 }
 
 
@@ -124,75 +613,137 @@ static const struct pw_stream_events stream_events = {
         .state_changed = on_state_changed,
         .param_changed = on_param_changed,
         .process = on_process,
+        .add_buffer = on_add_buffer,
+        .remove_buffer = on_remove_buffer,
 };
 
-struct wlxpw * wlxpw_initialize(const char * name, uint32_t node_id, uint32_t fps, struct format_collection * formats, void * on_frame)
-{
-    struct wlxpw* data = malloc(sizeof(struct wlxpw));
-    strcpy(data->name, name);
+void wlxpw_session_destroy(struct wlxpw_session * session);
 
-    data->want_dmabuf = formats != NULL;
-    data->on_frame = on_frame;
+/**
+ * Start the PipeWire loop thread and connect to the daemon
+ */
+struct wlxpw_session * wlxpw_session_new(const char * name)
+{
+    struct wlxpw_session * session = calloc(1, sizeof(struct wlxpw_session));
 
     pw_init(0, NULL);
 
-    data->loop = pw_thread_loop_new(name, 0);
-    if (data->loop == 0) {
-        printf("Failed @ pw_thread_loop_new!");
-        free(data);
+    session->loop = pw_thread_loop_new(name, 0);
+    if (session->loop == 0) {
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: failed @ pw_thread_loop_new");
+        free(session);
         return NULL;
     }
 
-    data->context = pw_context_new(pw_thread_loop_get_loop(data->loop), 0, 0);
-    if (data->context == 0) {
-        printf("Failed @ pw_context_new!");
-        free(data);
+    session->context = pw_context_new(pw_thread_loop_get_loop(session->loop), 0, 0);
+    if (session->context == 0) {
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: failed @ pw_context_new");
+        wlxpw_session_destroy(session);
         return NULL;
     }
 
-    pw_thread_loop_start(data->loop);
+    pw_thread_loop_start(session->loop);
 
-    pw_thread_loop_lock(data->loop);
+    pw_thread_loop_lock(session->loop);
+    session->core = pw_context_connect(session->context, 0, 0);
+    pw_thread_loop_unlock(session->loop);
 
-    data->core = pw_context_connect(data->context, 0, 0);
-    if (data->core == 0) {
-        printf("Failed @ pw_context_connect!");
-        pw_thread_loop_unlock(data->loop);
-        free(data);
+    if (session->core == 0) {
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: failed @ pw_context_connect");
+        wlxpw_session_destroy(session);
         return NULL;
     }
 
-    struct pw_properties * props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Video",
-                      PW_KEY_MEDIA_CATEGORY, "Capture",
-                      PW_KEY_MEDIA_ROLE, "Screen", NULL);
+    return session;
+}
 
-    data->stream = pw_stream_new(data->core, name, props);
-    if (data->stream == 0) {
-        printf("Failed @ pw_stream_new!");
-        pw_thread_loop_unlock(data->loop);
-        free(data);
-        return NULL;
+/**
+ * Stop the loop thread and disconnect. All streams must have been destroyed.
+ */
+void wlxpw_session_destroy(struct wlxpw_session * session)
+{
+    if (!session)
+        return;
+
+    if (session->num_streams > 0)
+        log_msg(LOG_LEVEL_WARN, "PipeWire: destroying session with %d streams left", session->num_streams);
+
+    if (session->core) {
+        pw_thread_loop_lock(session->loop);
+        pw_core_disconnect(session->core);
+        pw_thread_loop_unlock(session->loop);
     }
 
-    uint8_t buffer[4096];
-    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
-    int num_dmabuf_formats = data->want_dmabuf ? formats->num_formats : 0;
-    const struct spa_pod *params[num_dmabuf_formats + 1];
+    if (session->loop)
+        pw_thread_loop_stop(session->loop);
+
+    if (session->context)
+        pw_context_destroy(session->context);
+
+    if (session->loop)
+        pw_thread_loop_destroy(session->loop);
+
+    free(session);
+}
+
+static int set_rt_priority(struct spa_loop *loop, bool async, uint32_t seq,
+                           const void *data, size_t size, void *user_data)
+{
+    (void) loop; (void) async; (void) seq; (void) size; (void) user_data;
+
+    struct sched_param param = { .sched_priority = *(const int32_t *) data };
+    int policy = param.sched_priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+
+    int err = pthread_setschedparam(pthread_self(), policy, &param);
+    if (err != 0)
+        log_msg(LOG_LEVEL_WARN, "PipeWire: could not set loop priority %d: %s", param.sched_priority, strerror(err));
+    return -err;
+}
+
+/**
+ * Run the loop thread at a real-time priority, or 0 for normal scheduling.
+ * Usually needs RLIMIT_RTPRIO or CAP_SYS_NICE.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int32_t wlxpw_session_set_rt_priority(struct wlxpw_session * session, int32_t priority)
+{
+    return pw_loop_invoke(pw_thread_loop_get_loop(session->loop), set_rt_priority,
+                          0, &priority, sizeof(priority), true, NULL);
+}
+
+/**
+ * @return how many EnumFormat params build_enum_formats may produce
+ */
+static int max_enum_formats(struct wlxpw * data)
+{
+    return (data->want_dmabuf ? data->formats->num_formats : 0) + 1;
+}
+
+/**
+ * Build one EnumFormat param per dmabuf format and one for shm, preferring the
+ * size and framerate last requested for the stream.
+ * The compositor picks from the ranges, so the preference is only a hint.
+ *
+ * @return number of params written
+ */
+static int build_enum_formats(struct wlxpw * data, struct spa_pod_builder * b, const struct spa_pod ** params)
+{
     int p = 0;
 
     if (data->want_dmabuf)
-        for (int f = 0; f < formats->num_formats; f++) {
-            struct capture_format * cur_format = &formats->formats[f];
+        for (int f = 0; f < data->formats->num_formats; f++) {
+            struct capture_format * cur_format = &data->formats->formats[f];
             if (cur_format->num_modifiers < 1)
                 continue;
 
-            params[p++] = build_format(&b, fps,
+            params[p++] = build_format(b, data->req_width, data->req_height, data->req_fps,
                                        cur_format->format,
                                        cur_format->modifiers,
                                        cur_format->num_modifiers);
         }
 
-    params[p++] = spa_pod_builder_add_object(&b,
+    params[p++] = spa_pod_builder_add_object(b,
        SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
        SPA_FORMAT_mediaType,   SPA_POD_Id(SPA_MEDIA_TYPE_video),
        SPA_FORMAT_mediaSubtype,SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
@@ -202,42 +753,359 @@ struct wlxpw * wlxpw_initialize(const char * name, uint32_t node_id, uint32_t fp
             SPA_VIDEO_FORMAT_RGBx,
             SPA_VIDEO_FORMAT_BGRx),
        SPA_FORMAT_VIDEO_size,      SPA_POD_CHOICE_RANGE_Rectangle(
-            &SPA_RECTANGLE(320, 240),
+            &SPA_RECTANGLE(data->req_width, data->req_height),
             &SPA_RECTANGLE(1, 1),
             &SPA_RECTANGLE(8192, 8192)),
     SPA_FORMAT_VIDEO_framerate, SPA_POD_CHOICE_RANGE_Fraction(
-        &SPA_FRACTION(fps, 1),
+        &SPA_FRACTION(data->req_fps, 1),
         &SPA_FRACTION(0, 1),
         &SPA_FRACTION(1000, 1)));
 
+    return p;
+}
+
+/**
+ * Connect a stream for a screencast node on the loop of a session
+ *
+ * @param formats dmabuf formats to offer, or NULL for shm only. Kept for
+ *                renegotiation, so it must outlive the stream.
+ * @param on_frame called on the loop thread for each new frame, or NULL if
+ *                 frames are only taken with wlxpw_acquire_latest
+ * @param on_cursor called when the cursor moves or changes, or NULL if the
+ *                  cursor is embedded in the frames
+ */
+struct wlxpw * wlxpw_session_add_stream(struct wlxpw_session * session, const char * name, uint32_t node_id,
+                                        uint32_t fps, struct format_collection * formats,
+                                        void * on_frame, void * on_cursor)
+{
+    struct wlxpw* data = calloc(1, sizeof(struct wlxpw));
+    snprintf(data->name, sizeof(data->name), "%s", name);
+
+    data->session = session;
+    data->want_dmabuf = formats != NULL;
+    data->formats = formats;
+    data->req_width = 320; // arbitrary, the compositor sends its own size
+    data->req_height = 240;
+    data->req_fps = fps;
+    data->num_damage = -1;
+    data->on_frame = on_frame;
+    data->on_cursor = on_cursor;
+    pthread_mutex_init(&data->lease_lock, NULL);
+    pthread_cond_init(&data->lease_cond, NULL);
+
+    pw_thread_loop_lock(session->loop);
+
+    struct pw_properties * props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Video",
+                      PW_KEY_MEDIA_CATEGORY, "Capture",
+                      PW_KEY_MEDIA_ROLE, "Screen", NULL);
+
+    data->stream = pw_stream_new(session->core, name, props);
+    if (data->stream == 0) {
+        log_msg(LOG_LEVEL_ERROR, "PipeWire: failed @ pw_stream_new");
+        pw_thread_loop_unlock(session->loop);
+        pthread_mutex_destroy(&data->lease_lock);
+        pthread_cond_destroy(&data->lease_cond);
+        free(data);
+        return NULL;
+    }
+
+    uint8_t buffer[4096];
+    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    const struct spa_pod *params[max_enum_formats(data)];
+    int p = build_enum_formats(data, &b, params);
+
     pw_stream_add_listener(data->stream, &data->listener, &stream_events, data);
-    pw_stream_connect(data->stream, PW_DIRECTION_INPUT, node_id, PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS, params, p);
+    pw_stream_connect(data->stream, PW_DIRECTION_INPUT, node_id, PW_STREAM_FLAG_AUTOCONNECT, params, p);
+
+    session->num_streams++;
+    pw_thread_loop_unlock(session->loop);
+    return data;
+}
+
+/**
+ * Connect a stream on a session of its own, see wlxpw_session_add_stream
+ */
+struct wlxpw * wlxpw_initialize(const char * name, uint32_t node_id, uint32_t fps, struct format_collection * formats,
+                                void * on_frame, void * on_cursor)
+{
+    struct wlxpw_session * session = wlxpw_session_new(name);
+    if (!session)
+        return NULL;
+
+    struct wlxpw * data = wlxpw_session_add_stream(session, name, node_id, fps, formats, on_frame, on_cursor);
+    if (!data) {
+        wlxpw_session_destroy(session);
+        return NULL;
+    }
 
-    pw_thread_loop_unlock(data->loop);
+    data->own_session = true;
     return data;
 }
 
 void wlxpw_set_active(struct wlxpw * data, uint32_t active) {
-    if (data && data->stream)
+    if (data && data->stream) {
+        pw_thread_loop_lock(data->session->loop);
         pw_stream_set_active(data->stream, active);
+        pw_thread_loop_unlock(data->session->loop);
+    }
+}
+
+/**
+ * Ask the compositor for a different frame size and rate, e.g. to capture less
+ * while an overlay is small or far away. Compositors with a fixed output size
+ * ignore the size and keep sending full frames.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int32_t wlxpw_request_format(struct wlxpw * data, uint32_t width, uint32_t height, uint32_t fps) {
+    if (!data || !data->stream || width < 1 || height < 1)
+        return -EINVAL;
+
+    pw_thread_loop_lock(data->session->loop);
+
+    data->req_width = width;
+    data->req_height = height;
+    data->req_fps = fps;
+
+    uint8_t buffer[4096];
+    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    const struct spa_pod *params[max_enum_formats(data)];
+    int p = build_enum_formats(data, &b, params);
+
+    int res = pw_stream_update_params(data->stream, params, p);
+    pw_thread_loop_unlock(data->session->loop);
+
+    if (res < 0)
+        log_msg(LOG_LEVEL_WARN, "PipeWire: %s could not request %ux%u@%u: %s", data->name, width, height, fps, strerror(-res));
+    return res;
+}
+
+/**
+ * @return id of the node of a stream, SPA_ID_INVALID until it is connected
+ */
+uint32_t wlxpw_node_id(struct wlxpw * data) {
+    pw_thread_loop_lock(data->session->loop);
+    uint32_t id = pw_stream_get_node_id(data->stream);
+    pw_thread_loop_unlock(data->session->loop);
+    return id;
+}
+
+/**
+ * Copy what the consumer needs out of the newest buffer, so the frame outlives the buffer,
+ * and hand over the damage accumulated since the last one
+ */
+static void lease_fill(struct wlxpw *data, struct lease *l)
+{
+    struct pw_buffer *b = data->latest;
+    struct spa_buffer *buf = b->buffer;
+    struct wlxpw_frame *f = &l->frame;
+
+    memset(f, 0, sizeof(*f));
+    f->type = buf->datas[0].type;
+    f->format = data->latest_raw.format;
+    f->modifier = data->latest_raw.modifier;
+    f->width = data->latest_raw.size.width;
+    f->height = data->latest_raw.size.height;
+    f->buffers_generation = data->buffers_generation;
+    f->num_planes = (int32_t) SPA_MIN(buf->n_datas, MAX_PLANES);
+
+    for (int32_t p = 0; p < f->num_planes; p++) {
+        struct spa_data *d = &buf->datas[p];
+        f->fds[p] = f->type == SPA_DATA_DmaBuf ? fcntl((int) d->fd, F_DUPFD_CLOEXEC, 0) : -1;
+        f->offsets[p] = d->chunk->offset;
+        f->strides[p] = d->chunk->stride;
+    }
+
+    struct spa_data *d0 = &buf->datas[0];
+    l->map = NULL;
+    if (d0->data) {
+        f->data = SPA_PTROFF(d0->data, d0->chunk->offset, void);
+    } else if (f->type == SPA_DATA_MemFd && d0->fd >= 0) {
+        // on_add_buffer could not keep it mapped, so only this frame is
+        l->map = map_memfd(data, d0);
+        if (l->map)
+            f->data = SPA_PTROFF(l->map->ptr, d0->mapoffset + d0->chunk->offset, void);
+    }
+
+    f->num_damage = data->num_damage;
+    f->damage = l->damage;
+    if (data->num_damage > 0)
+        memcpy(l->damage, data->damage, sizeof(struct spa_region) * data->num_damage);
+    data->num_damage = 0;
+
+    l->used = true;
+    l->buffer = b;
+    l->reading = f->type == SPA_DATA_MemPtr;
+}
+
+static void lease_clear(struct lease *l)
+{
+    for (int32_t p = 0; p < l->frame.num_planes; p++) {
+        if (l->frame.fds[p] >= 0)
+            close(l->frame.fds[p]);
+    }
+
+    if (l->map) {
+        munmap(l->map->ptr, l->map->size);
+        free(l->map);
+    }
+
+    memset(l, 0, sizeof(*l));
+}
+
+/**
+ * Take the newest frame out of the stream. It is not reused by PipeWire
+ * until it is handed back with wlxpw_release.
+ * The format, size and damage of the frame are taken together with it, so they always match it.
+ *
+ * @return NULL if no frame arrived since the last call, or too many are leased
+ */
+struct wlxpw_frame * wlxpw_acquire_latest(struct wlxpw * data) {
+    struct wlxpw_frame *frame = NULL;
+
+    pw_thread_loop_lock(data->session->loop);
+    if (data->latest) {
+        for (int i = 0; i < MAX_LEASED; i++) {
+            struct lease *l = &data->leased[i];
+            if (l->used)
+                continue;
+
+            pthread_mutex_lock(&data->lease_lock);
+            lease_fill(data, l);
+            pthread_mutex_unlock(&data->lease_lock);
+
+            frame = &l->frame;
+            data->latest = NULL;
+            data->frames_acquired++;
+
+            uint64_t now = monotonic_ns();
+            latency_add(&data->process_to_acquire, (int64_t) (now - data->latest_process));
+            if (data->latest_pts)
+                latency_add(&data->produce_to_acquire, (int64_t) (now - data->latest_pts));
+            break;
+        }
+    }
+    pw_thread_loop_unlock(data->session->loop);
+
+    return frame;
+}
+
+/**
+ * Give a frame from wlxpw_acquire_latest back to the stream
+ */
+void wlxpw_release(struct wlxpw * data, struct wlxpw_frame * frame) {
+    struct lease *l = NULL;
+    for (int i = 0; i < MAX_LEASED; i++) {
+        if (&data->leased[i].frame == frame)
+            l = &data->leased[i];
+    }
+    if (!l)
+        return;
+
+    // a removal waiting for this frame holds the loop lock
+    pthread_mutex_lock(&data->lease_lock);
+    l->reading = false;
+    pthread_cond_broadcast(&data->lease_cond);
+    pthread_mutex_unlock(&data->lease_lock);
+
+    pw_thread_loop_lock(data->session->loop);
+    if (l->used) {
+        if (l->buffer)
+            pw_stream_queue_buffer(data->stream, l->buffer);
+        lease_clear(l);
+    }
+    pw_thread_loop_unlock(data->session->loop);
+}
+
+/**
+ * Get frame counters and the latency of the recent frames of a stream
+ */
+void wlxpw_get_latency(struct wlxpw * data, struct wlxpw_latency * out) {
+    pw_thread_loop_lock(data->session->loop);
+
+    out->frames = data->frames;
+    out->frames_dropped = data->frames_drained + data->frames_dropped;
+    out->seq_skipped = data->seq_skipped;
+    out->out_of_buffers = data->out_of_buffers;
+    latency_summarize(&data->produce_to_process, &out->produce_to_process);
+    latency_summarize(&data->process_to_acquire, &out->process_to_acquire);
+    latency_summarize(&data->produce_to_acquire, &out->produce_to_acquire);
+    latency_histogram(&data->produce_to_acquire, out->histogram);
+
+    pw_thread_loop_unlock(data->session->loop);
+}
+
+/**
+ * Get the counters of a stream, cheap enough to poll every frame
+ */
+void wlxpw_get_stats(struct wlxpw * data, struct wlxpw_stats * out) {
+    pw_thread_loop_lock(data->session->loop);
+
+    out->frames_received = data->frames;
+    out->frames_delivered = data->frames_delivered;
+    out->frames_drained = data->frames_drained;
+    out->frames_dropped = data->frames_dropped;
+    out->frames_acquired = data->frames_acquired;
+    out->out_of_buffers = data->out_of_buffers;
+    out->seq_skipped = data->seq_skipped;
+    out->bytes = data->bytes;
+    out->renegotiations = data->renegotiations;
+
+    pw_thread_loop_unlock(data->session->loop);
+}
+
+/**
+ * Send log messages of all streams to fn instead of stdout/stderr, NULL to go back.
+ * fn is called on the PipeWire loop thread and on the calling threads.
+ */
+void wlxpw_set_log(log_fn fn) {
+    log_set_callback(fn);
+}
+
+/**
+ * Downscale and convert a mapped 32 bit frame, see scale_bgrx
+ */
+void wlxpw_scale(struct wlxpw * data, const uint8_t *src, int32_t src_w, int32_t src_h, int32_t src_stride,
+                 uint8_t *dst, int32_t dst_w, int32_t dst_h, int32_t dst_stride,
+                 int32_t format) {
+    scale_bgrx(src, src_w, src_h, src_stride, dst, dst_w, dst_h, dst_stride, format, &data->scale);
 }
 
+/**
+ * Disconnect a stream, and stop its session if it was created by wlxpw_initialize
+ */
 void wlxpw_destroy(struct wlxpw * data) {
+    if (!data)
+        return;
+
+    struct wlxpw_session * session = data->session;
+
+    // the caller is the consumer, so it is not reading any frame
+    pthread_mutex_lock(&data->lease_lock);
+    for (int i = 0; i < MAX_LEASED; i++)
+        data->leased[i].reading = false;
+    pthread_mutex_unlock(&data->lease_lock);
+
+    pw_thread_loop_lock(session->loop);
     if (data->stream) {
         pw_stream_destroy(data->stream);
         data->stream = NULL;
     }
+    session->num_streams--;
+    pw_thread_loop_unlock(session->loop);
 
-    if (data->context) {
-        pw_context_destroy(data->context);
-    }
+    if (data->own_session)
+        wlxpw_session_destroy(session);
 
-    if (data->loop) {
-        pw_thread_loop_wait(data->loop);
-        pw_thread_loop_stop(data->loop);
-        pw_thread_loop_destroy(data->loop);
-        data->loop = NULL;
+    // leases the consumer still held, their buffers are gone with the stream
+    for (int i = 0; i < MAX_LEASED; i++) {
+        if (data->leased[i].used)
+            lease_clear(&data->leased[i]);
     }
 
+    pthread_mutex_destroy(&data->lease_lock);
+    pthread_cond_destroy(&data->lease_cond);
+    free(data->cursor.pixels);
+    scale_cache_free(&data->scale);
     free(data);
 }
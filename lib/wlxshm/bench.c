@@ -0,0 +1,315 @@
+/*
+ * Measures capture latency and throughput of libwlxshm against the X server in $DISPLAY.
+ * Works on any server with MIT-SHM, including Xvfb and Xephyr, see bench.sh.
+ *
+ * usage: wlxshm_bench [-s screen] [-m full|damage|pipelined] [-n frames] [-c change_pct]
+ *
+ * Every frame, a rectangle covering change_pct of the captured area is drawn on the
+ * root window through a second connection, so that damage tracking has work to do.
+ * Without -s, each screen is measured on its own and then all screens together;
+ * without -m, every mode is measured.
+ *
+ *   full       damage tracking off, every frame captured in full
+ *   damage     wlxshm_capture_frame, only damaged rects are fetched
+ *   pipelined  wlxshm_capture_begin/wlxshm_capture_poll, as used by the overlay
+ *
+ * Latency is the time from starting a capture until the frame is available.
+ * "blocked" is the part of it spent inside libwlxshm calls, which is what the
+ * render thread pays. Round trips count the times a capture waited on the server,
+ * which the pipelined mode never does, so it shows "-".
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xcb/xcb.h>
+
+#define WLXSHM_ALL_SCREENS (-1)
+
+// mirrors the structs exported by library.c
+
+struct vec2i_t {
+    int32_t x;
+    int32_t y;
+};
+
+struct rect_t {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+    int32_t offset;
+};
+
+struct buf_t {
+    int32_t length;
+    void *buffer;
+    int32_t num_rects;
+    struct rect_t *rects;
+};
+
+struct xshm_data;
+
+int32_t wlxshm_num_screens();
+struct xshm_data *wlxshm_create(int32_t screen, struct vec2i_t *size, struct vec2i_t *pos);
+void wlxshm_destroy(struct xshm_data *data);
+int32_t wlxshm_capture_start(struct xshm_data *data);
+struct buf_t *wlxshm_capture_frame(struct xshm_data *data);
+int32_t wlxshm_capture_begin(struct xshm_data *data);
+struct buf_t *wlxshm_capture_poll(struct xshm_data *data);
+int32_t wlxshm_capture_pending(struct xshm_data *data);
+void wlxshm_set_use_damage(struct xshm_data *data, int32_t enable);
+uint32_t wlxshm_round_trips(struct xshm_data *data);
+
+enum mode {
+    MODE_FULL,
+    MODE_DAMAGE,
+    MODE_PIPELINED,
+    NUM_MODES,
+};
+
+static const char *mode_names[NUM_MODES] = { "full", "damage", "pipelined" };
+
+// give up on a pipelined frame after this long
+#define POLL_TIMEOUT_MS 1000.0
+
+struct painter {
+    xcb_connection_t *xcb;
+    xcb_window_t root;
+    xcb_gcontext_t gc;
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int32_t n, double p)
+{
+    int32_t i = (int32_t) ceil(p / 100.0 * n) - 1;
+    return sorted[i < 0 ? 0 : i];
+}
+
+static bool painter_init(struct painter *p)
+{
+    p->xcb = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(p->xcb))
+        return false;
+
+    p->root = xcb_setup_roots_iterator(xcb_get_setup(p->xcb)).data->root;
+    p->gc = xcb_generate_id(p->xcb);
+    xcb_create_gc(p->xcb, p->gc, p->root, 0, NULL);
+    return true;
+}
+
+/**
+ * Draw a rect of the given share of the capture area, at a different spot each frame,
+ * and wait until the server has processed it
+ */
+static void painter_step(struct painter *p, struct vec2i_t *size, struct vec2i_t *pos,
+                         double pct, int32_t frame)
+{
+    if (pct > 0) {
+        double side = sqrt(pct / 100.0);
+        int32_t w = (int32_t) (size->x * side);
+        int32_t h = (int32_t) (size->y * side);
+        if (w < 1) w = 1;
+        if (h < 1) h = 1;
+
+        int32_t x = pos->x + (size->x - w > 0 ? (frame * 97) % (size->x - w + 1) : 0);
+        int32_t y = pos->y + (size->y - h > 0 ? (frame * 61) % (size->y - h + 1) : 0);
+
+        uint32_t color = (uint32_t) frame * 0x10101 + 0x203040;
+        xcb_change_gc(p->xcb, p->gc, XCB_GC_FOREGROUND, &color);
+
+        xcb_rectangle_t r = { (int16_t) x, (int16_t) y, (uint16_t) w, (uint16_t) h };
+        xcb_poly_fill_rectangle(p->xcb, p->root, p->gc, 1, &r);
+    }
+
+    free(xcb_get_input_focus_reply(p->xcb, xcb_get_input_focus(p->xcb), NULL));
+}
+
+static void run(struct painter *p, int32_t screen, enum mode mode, int32_t frames, double pct)
+{
+    struct vec2i_t size, pos;
+    struct xshm_data *data = wlxshm_create(screen, &size, &pos);
+    if (!data) {
+        printf("screen %d: unable to create capture\n", screen);
+        return;
+    }
+
+    // on failure the capture has already been destroyed
+    if (wlxshm_capture_start(data) != 0) {
+        printf("screen %d: unable to start capture\n", screen);
+        return;
+    }
+
+    wlxshm_set_use_damage(data, mode != MODE_FULL);
+
+    double *latency = calloc(frames, sizeof(double));
+    double *blocked = calloc(frames, sizeof(double));
+    int64_t bytes = 0, rects = 0;
+    int32_t captured = 0, timeouts = 0;
+    uint32_t rt0 = 0;
+    double busy = 0;
+
+    // the first frame is always a full one, keep it out of the numbers
+    for (int32_t f = -1; f < frames; f++) {
+        if (f == 0)
+            rt0 = wlxshm_round_trips(data);
+
+        painter_step(p, &size, &pos, pct, f + 1);
+
+        struct buf_t *buf = NULL;
+        double t0 = now_ms(), inside = 0;
+
+        if (mode == MODE_PIPELINED) {
+            double t = now_ms();
+            wlxshm_capture_begin(data);
+            inside += now_ms() - t;
+
+            while (wlxshm_capture_pending(data) && now_ms() - t0 < POLL_TIMEOUT_MS) {
+                t = now_ms();
+                buf = wlxshm_capture_poll(data);
+                inside += now_ms() - t;
+                if (buf->length)
+                    break;
+                usleep(20);
+            }
+            if (wlxshm_capture_pending(data))
+                timeouts += f >= 0;
+        } else {
+            buf = wlxshm_capture_frame(data);
+            inside = now_ms() - t0;
+        }
+
+        if (f < 0)
+            continue;
+
+        latency[f] = now_ms() - t0;
+        blocked[f] = inside;
+        busy += latency[f];
+
+        if (buf && buf->length) {
+            captured++;
+            bytes += buf->length;
+            rects += buf->num_rects;
+        }
+    }
+
+    uint32_t round_trips = wlxshm_round_trips(data) - rt0;
+    wlxshm_destroy(data);
+
+    qsort(latency, frames, sizeof(double), cmp_double);
+    qsort(blocked, frames, sizeof(double), cmp_double);
+
+    char name[16];
+    if (screen == WLXSHM_ALL_SCREENS)
+        snprintf(name, sizeof(name), "all");
+    else
+        snprintf(name, sizeof(name), "%d", screen);
+
+    // pipelined captures never wait on the server, so they have no round trips to count
+    char rt[16];
+    if (mode == MODE_PIPELINED)
+        snprintf(rt, sizeof(rt), "-");
+    else
+        snprintf(rt, sizeof(rt), "%.2f", (double) round_trips / frames);
+
+    printf("%-6s %-11s %5dx%-5d %7.3f %7.3f %7.3f %7.3f %9.3f %9.1f %7.2f %6s %6d\n",
+           name, mode_names[mode], size.x, size.y,
+           percentile(latency, frames, 50), percentile(latency, frames, 95),
+           percentile(latency, frames, 99), latency[frames - 1],
+           percentile(blocked, frames, 50),
+           busy > 0 ? (double) bytes / 1e3 / busy : 0,
+           captured ? (double) rects / captured : 0,
+           rt, timeouts);
+
+    free(latency);
+    free(blocked);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-s screen] [-m full|damage|pipelined] [-n frames] [-c change_pct]\n",
+            argv0);
+}
+
+int main(int argc, char **argv)
+{
+    int32_t screen = -2, frames = 300;
+    int32_t mode = -1;
+    double pct = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:m:n:c:")) != -1) {
+        switch (opt) {
+            case 's':
+                screen = strcmp(optarg, "all") == 0 ? WLXSHM_ALL_SCREENS : atoi(optarg);
+                break;
+            case 'm':
+                for (mode = 0; mode < NUM_MODES && strcmp(optarg, mode_names[mode]) != 0; mode++);
+                if (mode == NUM_MODES) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            case 'c':
+                pct = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (frames <= 0 || pct < 0 || pct > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct painter painter;
+    if (!painter_init(&painter)) {
+        fprintf(stderr, "unable to open X display\n");
+        return 1;
+    }
+
+    int32_t num_screens = wlxshm_num_screens();
+    printf("%d screens, %d frames, %.1f%% changed per frame\n\n", num_screens, frames, pct);
+    printf("%-6s %-11s %11s %7s %7s %7s %7s %9s %9s %7s %6s %6s\n",
+           "screen", "mode", "size", "p50 ms", "p95 ms", "p99 ms", "max ms",
+           "blocked", "MB/s", "rects", "rt/fr", "t/o");
+
+    int32_t first = screen == -2 ? 0 : screen;
+    int32_t last = screen == -2 ? num_screens : screen;
+
+    for (int32_t s = first; s <= last; s++) {
+        int32_t id = s == num_screens ? WLXSHM_ALL_SCREENS : s;
+        for (int32_t m = 0; m < NUM_MODES; m++) {
+            if (mode < 0 || mode == m)
+                run(&painter, id, m, frames, pct);
+        }
+    }
+
+    xcb_disconnect(painter.xcb);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#!/usr/bin/env sh
+# Run wlxshm_bench on a private Xvfb with the given screen layout.
+#
+# usage: bench.sh [WxH ...] [-- wlxshm_bench args]
+#
+# Each WxH adds a screen, placed side by side through Xinerama.
+# Default: a single 1920x1080 screen. Needs a build in this directory.
+
+DISPLAY_NUM=${BENCH_DISPLAY:-:97}
+
+screens=""
+n=0
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  screens="$screens -screen $n ${1}x24"
+  n=$((n + 1))
+  shift
+done
+[ "$1" = "--" ] && shift
+
+if [ $n -eq 0 ]; then
+  screens="-screen 0 1920x1080x24"
+  n=1
+fi
+
+xinerama=""
+[ $n -gt 1 ] && xinerama="+xinerama"
+
+# shellcheck disable=SC2086
+Xvfb "$DISPLAY_NUM" -nolisten tcp $xinerama $screens &
+XVFB_PID=$!
+trap 'kill $XVFB_PID' EXIT
+
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+  [ -S "/tmp/.X11-unix/X${DISPLAY_NUM#:}" ] && break
+  sleep 0.5
+done
+
+DISPLAY=$DISPLAY_NUM "$(dirname "$0")/wlxshm_bench" "$@"
@@ -6,31 +6,120 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <inttypes.h>
+#include <xcb/composite.h>
+#include <xcb/damage.h>
 #include <xcb/randr.h>
 #include <xcb/shm.h>
+#include <xcb/xcbext.h>
+#include <xcb/xfixes.h>
 #include <xcb/xinerama.h>
+#include <xcb/xinput.h>
 
+#include "log.h"
+#include "scale.h"
 #include "xhelpers.h"
 
 #define TEX_INTERNAL_FORMAT GL_BGRA
 #define TEX_EXTERNAL_FORMAT GL_BGR
 
+// above this many rects, a single full frame is cheaper than the requests
+#define MAX_DAMAGE_RECTS 32
+#define MAX_EXTRA_RECTS 4
+#define MAX_RECTS (MAX_DAMAGE_RECTS + MAX_EXTRA_RECTS)
+
+#define WLXSHM_ALL_SCREENS (-1)
+
+#define MAX_SCREENS 16
+
+// one frame being read by the caller, one being written by the X server
+#define NUM_FRAMES 2
+
 
 struct vec2i_t {
     int32_t x;
     int32_t y;
 };
 
+struct geo_t {
+    int_fast32_t x;
+    int_fast32_t y;
+    int_fast32_t w;
+    int_fast32_t h;
+};
+
+struct rect_t {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+    int32_t offset;
+};
+
+/**
+ * A captured frame.
+ *
+ * Each rect is stored tightly packed (stride w * 4) at buffer + offset.
+ * A full frame is a single rect covering the whole capture area.
+ * length is 0 if nothing has changed since the last frame.
+ */
 struct buf_t {
     int32_t length;
     void *buffer;
+    int32_t num_rects;
+    struct rect_t *rects;
+};
+
+/**
+ * The current cursor image, premultiplied BGRA.
+ * serial changes whenever the image does.
+ */
+struct cursor_t {
+    uint32_t serial;
+    int32_t width;
+    int32_t height;
+    int32_t xhot;
+    int32_t yhot;
+    void *pixels;
+};
+
+/**
+ * Counters of a capture since it was created, see wlxshm_get_stats
+ */
+struct wlxshm_stats {
+    // frames returned with content
+    uint64_t frames;
+    // captures given up because a reply was missing
+    uint64_t frames_failed;
+    // bytes the server wrote into shm for the returned frames
+    uint64_t bytes;
+    uint64_t get_image_requests;
+    // times a capture had to wait for the server
+    uint64_t round_trips;
+    // time spent blocked on replies in wlxshm_capture_frame
+    uint64_t wait_ns;
+    // time from sending the GetImage requests until the last reply was in
+    uint64_t reply_ns;
+    // screen layout or window geometry changes
+    uint64_t geometry_changes;
+};
+
+struct frame_t {
+    xcb_shm_t *xshm;
+    struct rect_t rects[MAX_RECTS];
+    struct buf_t buffer;
+};
+
+enum capture_state {
+    CAPTURE_IDLE,
+    CAPTURE_FETCH_DAMAGE,
+    CAPTURE_GET_IMAGE,
 };
 
 struct xshm_data {
     xcb_connection_t *xcb;
     xcb_screen_t *xcb_screen;
-    xcb_shm_t *xshm;
 
     char *server;
     uint_fast32_t screen_id;
@@ -49,30 +138,250 @@ struct xshm_data {
     int32_t adj_width;
     int_fast32_t adj_height;
 
+    // XComposite window capture, XCB_NONE when capturing screens
+    xcb_window_t window;
+    xcb_pixmap_t window_pixmap;
+    int_fast32_t window_border;
+    bool window_gone;
+
+    // what GetImage reads from and where damage is reported,
+    // as offsets of their origins from the root window
+    xcb_drawable_t drawable;
+    int_fast32_t drawable_x;
+    int_fast32_t drawable_y;
+    int_fast32_t damage_x;
+    int_fast32_t damage_y;
+
+    bool all_screens;
+    bool use_shm_fd;
     bool use_xinerama;
     bool use_randr;
+    bool randr_monitors;
+    bool use_damage;
+    bool use_xfixes;
+    bool use_xinput;
 
-    struct buf_t buffer;
+    uint8_t randr_event;
+    bool geometry_changed;
+    int_fast32_t num_screens;
+    struct geo_t screens[MAX_SCREENS];
+
+    uint8_t cursor_event;
+    uint8_t xinput_opcode;
+    bool cursor_changed;
+    bool pointer_moved;
+    struct vec2i_t pointer;
+    struct cursor_t cursor;
+
+    xcb_damage_damage_t damage;
+    xcb_xfixes_region_t damage_region;
+    uint8_t damage_event;
+    bool damaged;
+    bool damage_full;
+
+    int32_t num_extra;
+    struct rect_t extra[MAX_EXTRA_RECTS];
+    int32_t align;
+
+    struct frame_t frames[NUM_FRAMES];
+    uint_fast32_t front;
+
+    // filter tables of wlxshm_scale
+    struct scale_cache scale;
+
+    enum capture_state state;
+    bool pending_ok;
+    // a damage fetch for the next frame was sent while the GetImage replies are outstanding
+    bool prefetch;
+    xcb_xfixes_fetch_region_cookie_t region_c;
+    xcb_shm_get_image_cookie_t image_c[MAX_RECTS];
+    int_fast32_t num_image_c;
+    int_fast32_t num_image_r;
+
+    struct wlxshm_stats stats;
+    uint64_t request_ns;
+
+    struct buf_t empty;
 };
 
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
 bool xshm_check_extensions(xcb_connection_t *xcb)
 {
     bool ok = true;
 
     if (!xcb_get_extension_data(xcb, &xcb_shm_id)->present) {
-        printf("Missing SHM extension !");
+        log_msg(LOG_LEVEL_ERROR, "Missing SHM extension");
         ok = false;
     }
 
     if (!xcb_get_extension_data(xcb, &xcb_xinerama_id)->present)
-        printf("Missing Xinerama extension !");
+        log_msg(LOG_LEVEL_WARN, "Missing Xinerama extension");
 
     if (!xcb_get_extension_data(xcb, &xcb_randr_id)->present)
-        printf("Missing Randr extension !");
+        log_msg(LOG_LEVEL_WARN, "Missing Randr extension");
 
     return ok;
 }
 
+/**
+ * Read the geometry of the captured window into data->screens[0],
+ * naming a new pixmap for it when its size changed.
+ */
+static void xshm_load_window(struct xshm_data *data)
+{
+    struct geo_t *g = &data->screens[0];
+    int_fast32_t prev_w = g->w;
+    int_fast32_t prev_h = g->h;
+    xcb_window_t root;
+
+    data->num_screens = 1;
+    if (x11_window_geo(data->xcb, data->window, &g->x, &g->y, &g->w, &g->h,
+                       &data->window_border, &root) < 0) {
+        log_msg(LOG_LEVEL_WARN, "window 0x%x is gone", data->window);
+        data->window_gone = true;
+        return;
+    }
+
+    // damage is reported inside the border, the pixmap includes it
+    data->damage_x = g->x;
+    data->damage_y = g->y;
+    data->drawable_x = g->x - data->window_border;
+    data->drawable_y = g->y - data->window_border;
+
+    // the server allocates a new pixmap on every resize
+    if (data->window_pixmap && prev_w == g->w && prev_h == g->h)
+        return;
+
+    if (data->window_pixmap)
+        xcb_free_pixmap(data->xcb, data->window_pixmap);
+
+    data->window_pixmap = xcb_generate_id(data->xcb);
+    xcb_generic_error_t *err = xcb_request_check(data->xcb,
+            xcb_composite_name_window_pixmap_checked(data->xcb, data->window, data->window_pixmap));
+    if (err) {
+        log_msg(LOG_LEVEL_WARN, "failed to name pixmap of window 0x%x, is it mapped?", data->window);
+        free(err);
+        // the old pixmap is freed, read from the window until it can be named again on map
+        data->window_pixmap = XCB_NONE;
+        data->drawable = data->window;
+        data->drawable_x = data->damage_x;
+        data->drawable_y = data->damage_y;
+        g->w = g->h = 0;
+        return;
+    }
+
+    data->drawable = data->window_pixmap;
+}
+
+/**
+ * Read the layout of all screens into data->screens
+ */
+static void xshm_load_screens(struct xshm_data *data)
+{
+    if (data->window) {
+        xshm_load_window(data);
+        return;
+    }
+
+    int_fast32_t count = 1;
+    if (data->use_randr)
+        count = randr_screen_count(data->xcb, data->randr_monitors);
+    else if (data->use_xinerama)
+        count = xinerama_screen_count(data->xcb);
+
+    if (count > MAX_SCREENS)
+        count = MAX_SCREENS;
+
+    for (int_fast32_t s = 0; s < count; s++) {
+        struct geo_t *g = &data->screens[s];
+        int ret;
+
+        if (data->use_randr) {
+            ret = randr_screen_geo(data->xcb, data->randr_monitors, s,
+                                   &g->x, &g->y, &g->w, &g->h, NULL, NULL);
+        } else if (data->use_xinerama) {
+            ret = xinerama_screen_geo(data->xcb, s, &g->x, &g->y, &g->w, &g->h);
+        } else {
+            g->x = 0;
+            g->y = 0;
+            ret = x11_screen_geo(data->xcb, data->screen_id, &g->w, &g->h);
+        }
+
+        if (ret < 0)
+            g->x = g->y = g->w = g->h = 0;
+    }
+
+    data->num_screens = count;
+}
+
+static int_fast32_t xshm_screen_count(struct xshm_data *data)
+{
+    return data->num_screens;
+}
+
+/**
+ * Get the cached geometry of a single screen
+ *
+ * @return < 0 on error
+ */
+static int xshm_screen_geo(struct xshm_data *data, int_fast32_t screen,
+                           int_fast32_t *x, int_fast32_t *y,
+                           int_fast32_t *w, int_fast32_t *h)
+{
+    if (screen < 0 || screen >= data->num_screens || !data->screens[screen].w) {
+        *x = *y = *w = *h = 0;
+        return -1;
+    }
+
+    *x = data->screens[screen].x;
+    *y = data->screens[screen].y;
+    *w = data->screens[screen].w;
+    *h = data->screens[screen].h;
+    return 0;
+}
+
+/**
+ * Get the bounding box of all screens
+ *
+ * @return < 0 on error
+ */
+static int xshm_union_geo(struct xshm_data *data,
+                          int_fast32_t *x, int_fast32_t *y,
+                          int_fast32_t *w, int_fast32_t *h)
+{
+    int_fast32_t count = xshm_screen_count(data);
+    int_fast32_t x0 = INT32_MAX, y0 = INT32_MAX;
+    int_fast32_t x1 = INT32_MIN, y1 = INT32_MIN;
+
+    for (int_fast32_t s = 0; s < count; s++) {
+        int_fast32_t sx, sy, sw, sh;
+        if (xshm_screen_geo(data, s, &sx, &sy, &sw, &sh) < 0 || !sw || !sh)
+            continue;
+
+        if (sx < x0) x0 = sx;
+        if (sy < y0) y0 = sy;
+        if (sx + sw > x1) x1 = sx + sw;
+        if (sy + sh > y1) y1 = sy + sh;
+    }
+
+    if (x1 <= x0 || y1 <= y0) {
+        *x = *y = *w = *h = 0;
+        return -1;
+    }
+
+    *x = x0;
+    *y = y0;
+    *w = x1 - x0;
+    *h = y1 - y0;
+    return 0;
+}
+
 /**
  * Update the capture
  *
@@ -83,31 +392,18 @@ int_fast32_t xshm_update_geometry(struct xshm_data *data)
     int_fast32_t prev_width = data->adj_width;
     int_fast32_t prev_height = data->adj_height;
 
-    if (data->use_randr) {
-        if (randr_screen_geo(data->xcb, data->screen_id, &data->x_org,
-                             &data->y_org, &data->width, &data->height,
-                             &data->xcb_screen, NULL) < 0) {
-            return -1;
-        }
-    } else if (data->use_xinerama) {
-        if (xinerama_screen_geo(data->xcb, data->screen_id,
-                                &data->x_org, &data->y_org,
-                                &data->width, &data->height) < 0) {
-            return -1;
-        }
-        data->xcb_screen = xcb_get_screen(data->xcb, 0);
-    } else {
-        data->x_org = 0;
-        data->y_org = 0;
-        if (x11_screen_geo(data->xcb, data->screen_id, &data->width,
-                           &data->height) < 0) {
+    if (data->all_screens) {
+        if (xshm_union_geo(data, &data->x_org, &data->y_org,
+                           &data->width, &data->height) < 0) {
             return -1;
         }
-        data->xcb_screen = xcb_get_screen(data->xcb, data->screen_id);
+    } else if (xshm_screen_geo(data, data->use_randr || data->use_xinerama ? data->screen_id : 0,
+                               &data->x_org, &data->y_org, &data->width, &data->height) < 0) {
+        return -1;
     }
 
     if (!data->width || !data->height) {
-        printf("Failed to get geometry");
+        log_msg(LOG_LEVEL_ERROR, "Failed to get geometry");
         return -1;
     }
 
@@ -116,29 +412,20 @@ int_fast32_t xshm_update_geometry(struct xshm_data *data)
     data->adj_height = data->height;
     data->adj_width = data->width;
 
-    if (data->cut_top != 0) {
-        if (data->y_org > 0)
-            data->adj_y_org = data->y_org + data->cut_top;
-        else
-            data->adj_y_org = data->cut_top;
-        data->adj_height = data->adj_height - data->cut_top;
-    }
-    if (data->cut_left != 0) {
-        if (data->x_org > 0)
-            data->adj_x_org = data->x_org + data->cut_left;
-        else
-            data->adj_x_org = data->cut_left;
-        data->adj_width = data->adj_width - data->cut_left;
-    }
-    if (data->cut_right != 0)
-        data->adj_width = data->adj_width - data->cut_right;
-    if (data->cut_bot != 0)
-        data->adj_height = data->adj_height - data->cut_bot;
-
-    printf(
-         "Geometry %" PRIdFAST32 "x%" PRIdFAST32 " @ %" PRIdFAST32
-         ",%" PRIdFAST32,
-         data->width, data->height, data->x_org, data->y_org);
+    data->adj_y_org += data->cut_top;
+    data->adj_x_org += data->cut_left;
+    data->adj_width -= data->cut_left + data->cut_right;
+    data->adj_height -= data->cut_top + data->cut_bot;
+
+    if (data->adj_width <= 0 || data->adj_height <= 0) {
+        log_msg(LOG_LEVEL_ERROR, "Crop is larger than the capture");
+        return -1;
+    }
+
+    log_msg(LOG_LEVEL_INFO,
+            "Geometry %" PRIdFAST32 "x%" PRIdFAST32 " @ %" PRIdFAST32
+            ",%" PRIdFAST32,
+            data->width, data->height, data->x_org, data->y_org);
 
     if (prev_width == data->adj_width && prev_height == data->adj_height)
         return 0;
@@ -150,13 +437,13 @@ int32_t wlxshm_num_screens()
 {
     xcb_connection_t * xcb = xcb_connect(NULL, NULL);
     if (!xcb || xcb_connection_has_error(xcb)) {
-        printf("Unable to open X display !");
+        log_msg(LOG_LEVEL_ERROR, "Unable to open X display");
         return 0;
     }
 
     int retval = 1;
     if (randr_is_active(xcb))
-        retval = randr_screen_count(xcb);
+        retval = randr_screen_count(xcb, randr_has_monitors(xcb));
     else if (xinerama_is_active(xcb))
         retval =  xinerama_screen_count(xcb);
 
@@ -164,15 +451,108 @@ int32_t wlxshm_num_screens()
     return retval;
 }
 
+int32_t wlxshm_screen_count(struct xshm_data * data)
+{
+    return (int32_t) xshm_screen_count(data);
+}
+
+/**
+ * Get the geometry of a screen using the connection of an existing capture
+ *
+ * @return < 0 on error
+ */
+int32_t wlxshm_screen_geo(struct xshm_data * data, int32_t screen,
+                          struct vec2i_t *size, struct vec2i_t *pos)
+{
+    int_fast32_t x, y, w, h;
+
+    int ret = xshm_screen_geo(data, screen, &x, &y, &w, &h);
+
+    size->x = (int32_t) w;
+    size->y = (int32_t) h;
+    pos->x = (int32_t) x;
+    pos->y = (int32_t) y;
+    return ret;
+}
+
+static void xshm_discard_pending(struct xshm_data *data);
+
+/**
+ * Subscribe to cursor changes and pointer motion on the root window
+ */
+static void xshm_init_events(struct xshm_data *data)
+{
+    xcb_window_t root = data->xcb_screen->root;
+
+    data->pointer_moved = true;
+    data->use_xfixes = xfixes_is_active(data->xcb);
+    if (data->use_xfixes) {
+        data->cursor_event = xcb_get_extension_data(data->xcb, &xcb_xfixes_id)->first_event
+                             + XCB_XFIXES_CURSOR_NOTIFY;
+        data->cursor_changed = true;
+
+        xcb_xfixes_select_cursor_input(data->xcb, root,
+                                       XCB_XFIXES_CURSOR_NOTIFY_MASK_DISPLAY_CURSOR);
+    }
+
+    if (data->window) {
+        uint32_t mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+        xcb_change_window_attributes(data->xcb, data->window, XCB_CW_EVENT_MASK, &mask);
+    }
+
+    if (data->use_randr) {
+        data->randr_event = xcb_get_extension_data(data->xcb, &xcb_randr_id)->first_event
+                            + XCB_RANDR_SCREEN_CHANGE_NOTIFY;
+
+        xcb_randr_select_input(data->xcb, root,
+                               XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+                               XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+                               XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+    }
+
+    data->use_xinput = xinput_is_active(data->xcb);
+    if (data->use_xinput) {
+        struct {
+            xcb_input_event_mask_t head;
+            uint32_t mask;
+        } mask;
+
+        mask.head.deviceid = XCB_INPUT_DEVICE_ALL_MASTER;
+        mask.head.mask_len = 1;
+        mask.mask = XCB_INPUT_XI_EVENT_MASK_RAW_MOTION;
+
+        data->xinput_opcode = xcb_get_extension_data(data->xcb, &xcb_input_id)->major_opcode;
+        xcb_input_xi_select_events(data->xcb, root, 1, &mask.head);
+    }
+}
+
 void wlxshm_destroy(struct xshm_data * data) {
     if (!data)
         return;
 
-    if (data->xshm) {
-        xshm_xcb_detach(data->xshm);
-        data->xshm = NULL;
+    xshm_discard_pending(data);
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        if (data->frames[i].xshm) {
+            xshm_xcb_detach(data->frames[i].xshm);
+            data->frames[i].xshm = NULL;
+        }
+    }
+
+    if (data->damage) {
+        xcb_damage_destroy(data->xcb, data->damage);
+        xcb_xfixes_destroy_region(data->xcb, data->damage_region);
+        data->damage = XCB_NONE;
+        data->use_damage = false;
     }
 
+    free(data->cursor.pixels);
+    scale_cache_free(&data->scale);
+
+    if (data->window_pixmap)
+        xcb_free_pixmap(data->xcb, data->window_pixmap);
+    if (data->window && !data->window_gone)
+        xcb_composite_unredirect_window(data->xcb, data->window, XCB_COMPOSITE_REDIRECT_AUTOMATIC);
+
     if (data->xcb) {
         xcb_disconnect(data->xcb);
         data->xcb = NULL;
@@ -186,35 +566,134 @@ void wlxshm_destroy(struct xshm_data * data) {
     free(data);
 }
 
+void wlxshm_capture_geo(struct xshm_data * data, struct vec2i_t *size, struct vec2i_t *pos);
+
+/**
+ * Set up geometry, events and damage tracking once the capture target is known
+ */
+static void xshm_init_capture(struct xshm_data *data)
+{
+    xshm_load_screens(data);
+
+    if (xshm_update_geometry(data) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "failed to update geometry");
+    }
+
+    if (data->xcb_screen)
+        xshm_init_events(data);
+
+    if (data->use_xfixes && xdamage_is_active(data->xcb)) {
+        data->damage = xcb_generate_id(data->xcb);
+        data->damage_region = xcb_generate_id(data->xcb);
+        data->damage_event = xcb_get_extension_data(data->xcb, &xcb_damage_id)->first_event
+                             + XCB_DAMAGE_NOTIFY;
+
+        xcb_damage_create(data->xcb, data->damage,
+                          data->window ? data->window : data->xcb_screen->root,
+                          XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+        xcb_xfixes_create_region(data->xcb, data->damage_region, 0, NULL);
+        data->use_damage = true;
+    }
+}
+
+/**
+ * Create a capture of a single screen.
+ *
+ * Pass WLXSHM_ALL_SCREENS to capture the bounding box of all screens
+ * through a single connection and shm segment instead.
+ */
 struct xshm_data * wlxshm_create(int32_t screen,  struct vec2i_t *size,  struct vec2i_t *pos)
 {
     struct xshm_data * data = calloc(1, sizeof(struct xshm_data));
-    data->screen_id = screen;
+    data->all_screens = screen == WLXSHM_ALL_SCREENS;
+    data->screen_id = data->all_screens ? 0 : screen;
 
     data->xcb = xcb_connect(NULL, NULL);
     if (!data->xcb || xcb_connection_has_error(data->xcb)) {
-        printf("FATAL unable to open X display");
+        log_msg(LOG_LEVEL_ERROR, "unable to open X display");
         goto fail;
     }
 
     if (!xshm_check_extensions(data->xcb)) {
-        printf("FATAL xcb extension not supported");
+        log_msg(LOG_LEVEL_ERROR, "xcb extension not supported");
         goto fail;
     }
 
+    data->use_shm_fd = xshm_has_fd_passing(data->xcb);
     data->use_randr = randr_is_active(data->xcb) ? true : false;
     data->use_xinerama = xinerama_is_active(data->xcb) ? true : false;
+    if (data->use_randr)
+        data->randr_monitors = randr_has_monitors(data->xcb);
 
-    if (xshm_update_geometry(data) < 0) {
-        printf("failed to update geometry");
+    // randr and xinerama describe all monitors relative to the root of screen 0
+    data->xcb_screen = xcb_get_screen(data->xcb,
+                                      data->use_randr || data->use_xinerama ? 0 : data->screen_id);
+    if (data->xcb_screen)
+        data->drawable = data->xcb_screen->root;
+    xshm_init_capture(data);
+
+    wlxshm_capture_geo(data, size, pos);
+    return data;
+
+    fail:
+    wlxshm_destroy(data);
+    return NULL;
+}
+
+static xcb_screen_t *xshm_find_screen(xcb_connection_t *xcb, xcb_window_t root)
+{
+    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(xcb_get_setup(xcb));
+    for (; iter.rem; xcb_screen_next(&iter)) {
+        if (iter.data->root == root)
+            return iter.data;
+    }
+    return NULL;
+}
+
+/**
+ * Create a capture of a single top-level window through XComposite.
+ *
+ * The capture follows the window as it moves and resizes, reported by
+ * wlxshm_capture_begin like a change of the screen layout.
+ * The window is captured even while it is covered by other windows.
+ */
+struct xshm_data * wlxshm_create_window(uint32_t window, struct vec2i_t *size, struct vec2i_t *pos)
+{
+    struct xshm_data * data = calloc(1, sizeof(struct xshm_data));
+    data->window = window;
+
+    data->xcb = xcb_connect(NULL, NULL);
+    if (!data->xcb || xcb_connection_has_error(data->xcb)) {
+        log_msg(LOG_LEVEL_ERROR, "unable to open X display");
+        goto fail;
+    }
+
+    if (!xshm_check_extensions(data->xcb)) {
+        log_msg(LOG_LEVEL_ERROR, "xcb extension not supported");
+        goto fail;
+    }
+
+    if (!xcomposite_is_active(data->xcb)) {
+        log_msg(LOG_LEVEL_ERROR, "composite extension not supported");
+        goto fail;
     }
 
-    size->x = (int) data->adj_width;
-    size->y = (int) data->adj_height;
+    int_fast32_t x, y, w, h, border;
+    xcb_window_t root;
+    if (x11_window_geo(data->xcb, window, &x, &y, &w, &h, &border, &root) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "window 0x%x not found", window);
+        data->window_gone = true;
+        goto fail;
+    }
 
-    pos->x = (int) data->adj_x_org;
-    pos->y = (int) data->adj_y_org;
+    data->use_shm_fd = xshm_has_fd_passing(data->xcb);
+    data->use_randr = randr_is_active(data->xcb) ? true : false;
+    data->xcb_screen = xshm_find_screen(data->xcb, root);
+
+    xcb_composite_redirect_window(data->xcb, window, XCB_COMPOSITE_REDIRECT_AUTOMATIC);
+    xshm_init_capture(data);
 
+    wlxshm_capture_geo(data, size, pos);
     return data;
 
     fail:
@@ -223,27 +702,93 @@ struct xshm_data * wlxshm_create(int32_t screen,  struct vec2i_t *size,  struct
 }
 
 
+static void xshm_poll_events(struct xshm_data *data);
+
+/**
+ * Get the pointer position in root coordinates.
+ *
+ * With XInput available, the X server is only queried after the pointer has moved.
+ */
 void wlxshm_mouse_pos_global(struct xshm_data * data, struct vec2i_t *vec)
 {
+    xshm_poll_events(data);
+
+    if (data->use_xinput && !data->pointer_moved) {
+        *vec = data->pointer;
+        return;
+    }
+    data->pointer_moved = false;
+
     xcb_query_pointer_cookie_t xp_c =
             xcb_query_pointer_unchecked(data->xcb, data->xcb_screen->root);
     xcb_query_pointer_reply_t *xp =
             xcb_query_pointer_reply(data->xcb, xp_c, NULL);
 
-    if (!xp)
+    if (!xp) {
+        data->pointer_moved = true;
         return;
+    }
 
-    vec->x = xp->root_x;
-    vec->y = xp->root_y;
+    data->pointer.x = xp->root_x;
+    data->pointer.y = xp->root_y;
+    *vec = data->pointer;
 
     free(xp);
 }
 
+/**
+ * Get the current cursor image. The image is only fetched from the X server
+ * when XFixes reports a cursor change.
+ *
+ * @return NULL if XFixes is not available
+ */
+struct cursor_t * wlxshm_get_cursor(struct xshm_data * data)
+{
+    if (!data->use_xfixes)
+        return NULL;
+
+    xshm_poll_events(data);
+
+    if (!data->cursor_changed)
+        return &data->cursor;
+    data->cursor_changed = false;
+
+    xcb_xfixes_get_cursor_image_cookie_t cur_c;
+    xcb_xfixes_get_cursor_image_reply_t *cur_r;
+
+    cur_c = xcb_xfixes_get_cursor_image(data->xcb);
+    cur_r = xcb_xfixes_get_cursor_image_reply(data->xcb, cur_c, NULL);
+    if (!cur_r)
+        return &data->cursor;
+
+    struct cursor_t *cur = &data->cursor;
+    if (cur->pixels == NULL || cur->serial != cur_r->cursor_serial) {
+        size_t len = (size_t) cur_r->width * cur_r->height * 4;
+        void *pixels = realloc(cur->pixels, len ? len : 4);
+        if (pixels) {
+            memcpy(pixels, xcb_xfixes_get_cursor_image_cursor_image(cur_r), len);
+            cur->pixels = pixels;
+            cur->serial = cur_r->cursor_serial;
+            cur->width = cur_r->width;
+            cur->height = cur_r->height;
+            cur->xhot = cur_r->xhot;
+            cur->yhot = cur_r->yhot;
+        }
+    }
+
+    free(cur_r);
+    return cur;
+}
+
 int32_t wlxshm_capture_start(struct xshm_data * data){
 
-    data->xshm = xshm_xcb_attach(data->xcb, data->adj_width, data->adj_height);
-    if (!data->xshm) {
-        printf("FATAL failed to attach shm");
+    data->damage_full = true;
+    data->num_extra = 0;
+    data->front = 0;
+    data->frames[0].xshm = xshm_xcb_attach(data->xcb, data->adj_width, data->adj_height,
+                                           data->use_shm_fd);
+    if (!data->frames[0].xshm) {
+        log_msg(LOG_LEVEL_ERROR, "failed to attach shm");
         wlxshm_destroy(data);
         return 1;
     }
@@ -253,35 +798,626 @@ int32_t wlxshm_capture_start(struct xshm_data * data){
 
 void wlxshm_capture_end(struct xshm_data * data){
 
-    xshm_xcb_detach(data->xshm);
-    data->xshm = NULL;
+    xshm_discard_pending(data);
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        xshm_xcb_detach(data->frames[i].xshm);
+        data->frames[i].xshm = NULL;
+    }
+}
+
+/**
+ * Mark an area of the capture as dirty, so that it is included in the next frame
+ * even if the X server reports no damage there.
+ */
+void wlxshm_add_damage(struct xshm_data * data, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    if (x < 0) {
+        w += x;
+        x = 0;
+    }
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if (x + w > data->adj_width)
+        w = data->adj_width - x;
+    if (y + h > data->adj_height)
+        h = data->adj_height - y;
+
+    if (w <= 0 || h <= 0)
+        return;
+
+    if (data->num_extra == MAX_EXTRA_RECTS) {
+        data->damage_full = true;
+        return;
+    }
+
+    struct rect_t *r = &data->extra[data->num_extra++];
+    r->x = x;
+    r->y = y;
+    r->w = w;
+    r->h = h;
+}
+
+/**
+ * Align damage rects to a multiple of align pixels from the capture origin,
+ * so that each rect can be downscaled by that factor on its own.
+ */
+void wlxshm_set_align(struct xshm_data * data, int32_t align)
+{
+    data->align = align > 1 ? align : 1;
+}
+
+/**
+ * Turn damage tracking off to capture every frame in full, or back on
+ * if the server supports it. The next frame is always a full one.
+ */
+void wlxshm_set_use_damage(struct xshm_data * data, int32_t enable)
+{
+    xshm_discard_pending(data);
+    data->use_damage = enable && data->damage;
+    data->damage_full = true;
+    data->num_extra = 0;
+}
+
+/**
+ * @return whether a capture started by wlxshm_capture_begin is still in flight
+ */
+int32_t wlxshm_capture_pending(struct xshm_data * data)
+{
+    return data->state != CAPTURE_IDLE;
+}
+
+/**
+ * @return how many times wlxshm_capture_frame has blocked on a server reply
+ */
+uint32_t wlxshm_round_trips(struct xshm_data * data)
+{
+    return (uint32_t) data->stats.round_trips;
+}
+
+/**
+ * Get the counters of a capture, cheap enough to poll every frame
+ */
+void wlxshm_get_stats(struct xshm_data * data, struct wlxshm_stats * out)
+{
+    *out = data->stats;
+}
+
+/**
+ * Send log messages of all captures to fn instead of stdout/stderr, NULL to go back
+ */
+void wlxshm_set_log(log_fn fn)
+{
+    log_set_callback(fn);
+}
+
+/**
+ * Downscale and convert a BGRx image, see scale_bgrx
+ */
+void wlxshm_scale(struct xshm_data *data, const uint8_t *src, int32_t src_w, int32_t src_h, int32_t src_stride,
+                  uint8_t *dst, int32_t dst_w, int32_t dst_h, int32_t dst_stride,
+                  int32_t format)
+{
+    scale_bgrx(src, src_w, src_h, src_stride, dst, dst_w, dst_h, dst_stride, format, &data->scale);
+}
+
+static void xshm_poll_events(struct xshm_data *data)
+{
+    xcb_generic_event_t *ev;
+    while ((ev = xcb_poll_for_event(data->xcb))) {
+        uint8_t type = ev->response_type & ~0x80;
+
+        if (data->use_damage && type == data->damage_event)
+            data->damaged = true;
+        else if (data->use_xfixes && type == data->cursor_event)
+            data->cursor_changed = true;
+        else if (data->use_randr && (type == data->randr_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY
+                                     || type == data->randr_event + XCB_RANDR_NOTIFY))
+            data->geometry_changed = true;
+        else if (data->window && (type == XCB_CONFIGURE_NOTIFY || type == XCB_MAP_NOTIFY))
+            data->geometry_changed = true;
+        else if (data->window && type == XCB_DESTROY_NOTIFY
+                 && ((xcb_destroy_notify_event_t *) ev)->window == data->window)
+            data->window_gone = true;
+        else if (data->use_xinput && type == XCB_GE_GENERIC
+                 && ((xcb_ge_generic_event_t *) ev)->extension == data->xinput_opcode)
+            data->pointer_moved = true;
+
+        free(ev);
+    }
+}
+
+/**
+ * Drop any requests still in flight. The damage they consumed is lost,
+ * so the next frame will be a full one.
+ */
+static void xshm_discard_pending(struct xshm_data *data)
+{
+    if (data->state == CAPTURE_FETCH_DAMAGE || data->prefetch) {
+        xcb_discard_reply(data->xcb, data->region_c.sequence);
+    }
+    if (data->state == CAPTURE_GET_IMAGE) {
+        for (int_fast32_t i = data->num_image_r; i < data->num_image_c; i++)
+            xcb_discard_reply(data->xcb, data->image_c[i].sequence);
+    }
+
+    if (data->state != CAPTURE_IDLE)
+        data->damage_full = true;
+
+    data->state = CAPTURE_IDLE;
+    data->prefetch = false;
+}
+
+static void xshm_request_damage(struct xshm_data *data)
+{
+    data->damaged = false;
+
+    xcb_damage_subtract(data->xcb, data->damage, XCB_NONE, data->damage_region);
+    data->region_c = xcb_xfixes_fetch_region(data->xcb, data->damage_region);
+}
+
+/**
+ * Grow a rect outwards to multiples of data->align, within the capture
+ */
+static void xshm_align_rect(struct xshm_data *data, struct rect_t *r)
+{
+    int32_t a = data->align;
+    if (a <= 1)
+        return;
+
+    int32_t x1 = (r->x + r->w + a - 1) / a * a;
+    int32_t y1 = (r->y + r->h + a - 1) / a * a;
+    r->x = r->x / a * a;
+    r->y = r->y / a * a;
+
+    if (x1 > data->adj_width) x1 = (int32_t) data->adj_width;
+    if (y1 > data->adj_height) y1 = (int32_t) data->adj_height;
+    r->w = x1 - r->x;
+    r->h = y1 - r->y;
+}
+
+/**
+ * Collect the damaged area of the capture into rects
+ *
+ * @param reg_r damage region reply, or NULL if only the extra rects are needed
+ * @return number of rects, < 0 if a full frame should be captured instead
+ */
+static int_fast32_t xshm_collect_damage(struct xshm_data *data,
+                                        xcb_xfixes_fetch_region_reply_t *reg_r,
+                                        struct rect_t *rects)
+{
+    int_fast32_t num_rects = 0;
+    int_fast64_t area = 0;
+
+    if (reg_r) {
+        xcb_rectangle_t *reg = xcb_xfixes_fetch_region_rectangles(reg_r);
+        int len = xcb_xfixes_fetch_region_rectangles_length(reg_r);
+
+        for (int i = 0; i < len; i++) {
+            int_fast32_t x0 = reg[i].x + data->damage_x - data->adj_x_org;
+            int_fast32_t y0 = reg[i].y + data->damage_y - data->adj_y_org;
+            int_fast32_t x1 = x0 + reg[i].width;
+            int_fast32_t y1 = y0 + reg[i].height;
+
+            if (x0 < 0) x0 = 0;
+            if (y0 < 0) y0 = 0;
+            if (x1 > data->adj_width) x1 = data->adj_width;
+            if (y1 > data->adj_height) y1 = data->adj_height;
+
+            if (x1 <= x0 || y1 <= y0)
+                continue;
+
+            if (num_rects == MAX_DAMAGE_RECTS)
+                return -1;
+
+            struct rect_t *r = &rects[num_rects++];
+            r->x = (int32_t) x0;
+            r->y = (int32_t) y0;
+            r->w = (int32_t) (x1 - x0);
+            r->h = (int32_t) (y1 - y0);
+            xshm_align_rect(data, r);
+            area += r->w * r->h;
+        }
+    }
+
+    for (int_fast32_t i = 0; i < data->num_extra; i++) {
+        struct rect_t *r = &rects[num_rects++];
+        *r = data->extra[i];
+        xshm_align_rect(data, r);
+        area += r->w * r->h;
+    }
+    data->num_extra = 0;
+
+    // extra rects may overlap, so the packed rects must still fit the segment
+    if (area * 4 > (int_fast64_t) data->adj_width * data->adj_height * 3)
+        return -1;
+
+    return num_rects;
+}
+
+static void xshm_request_rects(struct xshm_data *data, struct frame_t *frame,
+                               int_fast32_t num_rects)
+{
+    int32_t offset = 0;
+
+    for (int_fast32_t i = 0; i < num_rects; i++) {
+        struct rect_t *r = &frame->rects[i];
+        r->offset = offset;
+        offset += r->w * r->h * 4;
+
+        data->image_c[i] = xcb_shm_get_image_unchecked(data->xcb, data->drawable,
+                                                       data->adj_x_org - data->drawable_x + r->x,
+                                                       data->adj_y_org - data->drawable_y + r->y,
+                                                       r->w, r->h,
+                                                       ~0, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                                       frame->xshm->seg, r->offset);
+    }
+
+    frame->buffer.length = offset;
+    frame->buffer.buffer = frame->xshm->data;
+    frame->buffer.num_rects = (int32_t) num_rects;
+    frame->buffer.rects = frame->rects;
+
+    data->num_image_c = num_rects;
+    data->num_image_r = 0;
+    data->pending_ok = true;
+    data->state = CAPTURE_GET_IMAGE;
+
+    data->stats.get_image_requests += num_rects;
+    data->request_ns = monotonic_ns();
+}
+
+static void xshm_request_full(struct xshm_data *data, struct frame_t *frame)
+{
+    if (data->use_damage) {
+        // anything damaged so far is covered by this frame
+        xcb_damage_subtract(data->xcb, data->damage, XCB_NONE, XCB_NONE);
+        data->damaged = false;
+        data->num_extra = 0;
+    }
+
+    frame->rects[0].x = 0;
+    frame->rects[0].y = 0;
+    frame->rects[0].w = data->adj_width;
+    frame->rects[0].h = data->adj_height;
+
+    xshm_request_rects(data, frame, 1);
+}
+
+/**
+ * Turn the reply to a pipelined damage fetch into GetImage requests for frame,
+ * without blocking
+ *
+ * @return false if the reply has not arrived yet
+ */
+static bool xshm_damage_reply(struct xshm_data *data, struct frame_t *frame)
+{
+    void *reply = NULL;
+    xcb_generic_error_t *err = NULL;
+
+    if (!xcb_poll_for_reply(data->xcb, data->region_c.sequence, &reply, &err))
+        return false;
+    free(err);
+
+    // a failed frame in the meantime needs a full one
+    int_fast32_t num_rects = -1;
+    if (reply && !data->damage_full)
+        num_rects = xshm_collect_damage(data, reply, frame->rects);
+    free(reply);
+
+    if (num_rects == 0) {
+        data->state = CAPTURE_IDLE;
+        return true;
+    }
+
+    if (num_rects < 0)
+        xshm_request_full(data, frame);
+    else
+        xshm_request_rects(data, frame, num_rects);
+
+    xcb_flush(data->xcb);
+    return true;
+}
+
+/**
+ * Handle the reply to the next outstanding GetImage request
+ */
+static void xshm_image_reply(struct xshm_data *data, struct frame_t *frame,
+                             xcb_shm_get_image_reply_t *img_r)
+{
+    if (!img_r)
+        data->pending_ok = false;
+    else if (data->num_image_c == 1 && frame->rects[0].w == data->adj_width
+             && frame->rects[0].h == data->adj_height)
+        frame->buffer.length = (int32_t) img_r->size;
+
+    data->num_image_r++;
+}
+
+/**
+ * Called once all replies for frame have arrived
+ *
+ * @return the completed frame, or the empty buffer on failure
+ */
+static struct buf_t * xshm_finish_frame(struct xshm_data *data, struct frame_t *frame)
+{
+    data->state = CAPTURE_IDLE;
+    data->stats.reply_ns += monotonic_ns() - data->request_ns;
+
+    if (!data->pending_ok) {
+        data->stats.frames_failed++;
+        data->damage_full = true;
+        return &data->empty;
+    }
+
+    data->stats.frames++;
+    data->stats.bytes += frame->buffer.length;
+    data->damage_full = false;
+    return &frame->buffer;
+}
+
+/**
+ * Reload the screen layout after randr reported a change, and resize
+ * the shm segments if the captured area changed size.
+ *
+ * @return < 0 on error, 0 when unchanged, > 0 when the geometry changed
+ */
+static int_fast32_t xshm_handle_geometry(struct xshm_data *data)
+{
+    if (!data->geometry_changed)
+        return 0;
+    data->geometry_changed = false;
+
+    int_fast32_t prev_x = data->adj_x_org;
+    int_fast32_t prev_y = data->adj_y_org;
+
+    // outstanding requests may read from a window pixmap that is about to be freed
+    if (data->window)
+        xshm_discard_pending(data);
+
+    xshm_load_screens(data);
+    int_fast32_t ret = xshm_update_geometry(data);
+    if (ret < 0)
+        return -1;
+
+    if (ret == 0 && prev_x == data->adj_x_org && prev_y == data->adj_y_org)
+        return 0;
+
+    xshm_discard_pending(data);
+    data->damage_full = true;
+    data->num_extra = 0;
+    data->stats.geometry_changes++;
+
+    if (ret > 0 && data->frames[data->front].xshm) {
+        for (int i = 0; i < NUM_FRAMES; i++) {
+            xshm_xcb_detach(data->frames[i].xshm);
+            data->frames[i].xshm = NULL;
+        }
+
+        // the back buffer is attached lazily by wlxshm_capture_begin
+        data->front = 0;
+        data->frames[0].xshm = xshm_xcb_attach(data->xcb, data->adj_width, data->adj_height,
+                                               data->use_shm_fd);
+        if (!data->frames[0].xshm) {
+            log_msg(LOG_LEVEL_ERROR, "failed to resize shm");
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Get the area currently being captured, in root coordinates
+ */
+void wlxshm_capture_geo(struct xshm_data * data, struct vec2i_t *size, struct vec2i_t *pos)
+{
+    size->x = (int32_t) data->adj_width;
+    size->y = (int32_t) data->adj_height;
+    pos->x = (int32_t) data->adj_x_org;
+    pos->y = (int32_t) data->adj_y_org;
+}
+
+/**
+ * Crop the captured area by the given number of pixels from each edge
+ * of the screen or window. Once capturing, the new area is picked up by
+ * the next wlxshm_capture_begin, which reports it as a geometry change.
+ *
+ * @return < 0 if nothing would be left to capture
+ */
+int32_t wlxshm_set_crop(struct xshm_data * data, int32_t top, int32_t left,
+                        int32_t right, int32_t bottom)
+{
+    if (top < 0 || left < 0 || right < 0 || bottom < 0
+        || left + right >= data->width || top + bottom >= data->height)
+        return -1;
+
+    data->cut_top = top;
+    data->cut_left = left;
+    data->cut_right = right;
+    data->cut_bot = bottom;
+
+    if (data->frames[data->front].xshm)
+        data->geometry_changed = true;
+    else
+        xshm_update_geometry(data);
+
+    return 0;
 }
 
 struct buf_t * wlxshm_capture_frame(struct xshm_data * data)
 {
-    if (!data->xshm)
-        goto Empty;
+    data->empty.length = 0;
+
+    if (!data->frames[data->front].xshm)
+        return &data->empty;
+
+    xshm_poll_events(data);
+    if (data->window_gone || xshm_handle_geometry(data) < 0)
+        return &data->empty;
+
+    xshm_discard_pending(data);
 
-    xcb_shm_get_image_cookie_t img_c;
-    xcb_shm_get_image_reply_t *img_r;
+    struct frame_t *frame = &data->frames[data->front];
+    int_fast32_t num_rects = -1;
+
+    if (data->use_damage && !data->damage_full) {
+        xshm_poll_events(data);
+
+        if (data->damaged) {
+            xshm_request_damage(data);
+            data->stats.round_trips++;
+            uint64_t t0 = monotonic_ns();
+            xcb_xfixes_fetch_region_reply_t *reg_r =
+                    xcb_xfixes_fetch_region_reply(data->xcb, data->region_c, NULL);
+            data->stats.wait_ns += monotonic_ns() - t0;
+            if (reg_r)
+                num_rects = xshm_collect_damage(data, reg_r, frame->rects);
+            free(reg_r);
+        } else {
+            num_rects = xshm_collect_damage(data, NULL, frame->rects);
+        }
 
-    img_c = xcb_shm_get_image_unchecked(data->xcb, data->xcb_screen->root,
-                                        data->adj_x_org, data->adj_y_org,
-                                        data->adj_width, data->adj_height,
-                                        ~0, XCB_IMAGE_FORMAT_Z_PIXMAP,
-                                        data->xshm->seg, 0);
+        if (num_rects == 0)
+            return &data->empty;
+    }
 
-    img_r = xcb_shm_get_image_reply(data->xcb, img_c, NULL);
+    if (num_rects < 0)
+        xshm_request_full(data, frame);
+    else
+        xshm_request_rects(data, frame, num_rects);
 
-    if (img_r) {
-        data->buffer.length = img_r->size;
-        data->buffer.buffer = data->xshm->data;
+    // the GetImage requests are answered in one go
+    data->stats.round_trips++;
+    uint64_t t0 = monotonic_ns();
+    for (int_fast32_t i = 0; i < data->num_image_c; i++) {
+        xcb_shm_get_image_reply_t *img_r =
+                xcb_shm_get_image_reply(data->xcb, data->image_c[i], NULL);
+        xshm_image_reply(data, frame, img_r);
         free(img_r);
-        return &data->buffer;
+    }
+    data->stats.wait_ns += monotonic_ns() - t0;
+
+    return xshm_finish_frame(data, frame);
+}
+
+/**
+ * Start capturing the next frame into the back buffer without waiting for it.
+ * Does nothing if a capture is already in flight.
+ *
+ * @return < 0 on error, 1 if the screen layout changed and the caller
+ *         should query the geometry again, 0 otherwise
+ */
+int32_t wlxshm_capture_begin(struct xshm_data * data)
+{
+    if (!data->frames[data->front].xshm)
+        return -1;
+
+    xshm_poll_events(data);
+    if (data->window_gone)
+        return -1;
+
+    int32_t ret = (int32_t) xshm_handle_geometry(data);
+    if (ret < 0)
+        return -1;
+
+    struct frame_t *back = &data->frames[(data->front + 1) % NUM_FRAMES];
+
+    if (data->state == CAPTURE_FETCH_DAMAGE) {
+        xshm_damage_reply(data, back);
+        return ret;
     }
 
-    Empty:
-    data->buffer.length = 0;
-    data->buffer.buffer = 0;
-    return &data->buffer;
-}
\ No newline at end of file
+    if (data->state == CAPTURE_GET_IMAGE) {
+        // have the damage of the next frame ready by the time this one is done
+        if (data->use_damage && !data->damage_full && !data->prefetch) {
+            if (data->damaged) {
+                xshm_request_damage(data);
+                data->prefetch = true;
+                xcb_flush(data->xcb);
+            }
+        }
+        return ret;
+    }
+
+    if (!back->xshm) {
+        back->xshm = xshm_xcb_attach(data->xcb, data->adj_width, data->adj_height,
+                                     data->use_shm_fd);
+        if (!back->xshm) {
+            log_msg(LOG_LEVEL_ERROR, "failed to attach back buffer shm");
+            return -1;
+        }
+    }
+
+    if (data->use_damage && !data->damage_full) {
+        if (data->damaged) {
+            xshm_request_damage(data);
+            data->state = CAPTURE_FETCH_DAMAGE;
+            xcb_flush(data->xcb);
+            return ret;
+        }
+
+        int_fast32_t num_rects = xshm_collect_damage(data, NULL, back->rects);
+        if (num_rects == 0)
+            return ret;
+
+        if (num_rects > 0) {
+            xshm_request_rects(data, back, num_rects);
+            xcb_flush(data->xcb);
+            return ret;
+        }
+    }
+
+    xshm_request_full(data, back);
+    xcb_flush(data->xcb);
+    return ret;
+}
+
+/**
+ * Check on the capture started by wlxshm_capture_begin without blocking.
+ *
+ * The returned buffer stays valid until the next frame is returned.
+ *
+ * @return the new frame, or a buffer with length 0 if none is ready
+ */
+struct buf_t * wlxshm_capture_poll(struct xshm_data * data)
+{
+    data->empty.length = 0;
+
+    uint_fast32_t back_idx = (data->front + 1) % NUM_FRAMES;
+    struct frame_t *back = &data->frames[back_idx];
+
+    // the GetImage requests go out as soon as the damage is known, and may be answered right away
+    if (data->state == CAPTURE_FETCH_DAMAGE && !xshm_damage_reply(data, back))
+        return &data->empty;
+
+    if (data->state != CAPTURE_GET_IMAGE)
+        return &data->empty;
+
+    while (data->num_image_r < data->num_image_c) {
+        void *reply = NULL;
+        xcb_generic_error_t *err = NULL;
+        if (!xcb_poll_for_reply(data->xcb, data->image_c[data->num_image_r].sequence, &reply, &err))
+            return &data->empty;
+
+        xshm_image_reply(data, back, reply);
+        free(reply);
+        free(err);
+    }
+
+    struct buf_t *buf = xshm_finish_frame(data, back);
+    if (buf == &back->buffer) {
+        data->front = back_idx;
+        back = &data->frames[(back_idx + 1) % NUM_FRAMES];
+    }
+
+    // the previous front buffer is free now, so the next frame can be requested into it
+    if (data->prefetch) {
+        data->prefetch = false;
+        data->state = CAPTURE_FETCH_DAMAGE;
+        xshm_damage_reply(data, back);
+    }
+
+    return buf;
+}
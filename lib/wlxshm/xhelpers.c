@@ -15,17 +15,27 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE
+
 #include <malloc.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
+#include <unistd.h>
+#include <xcb/composite.h>
+#include <xcb/damage.h>
 #include <xcb/randr.h>
 #include <xcb/xcb.h>
+#include <xcb/xfixes.h>
+#include <xcb/xinput.h>
 #include <xcb/xinerama.h>
 
 #include "xhelpers.h"
 
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 bool xinerama_is_active(xcb_connection_t *xcb)
 {
     if (!xcb || !xcb_get_extension_data(xcb, &xcb_xinerama_id)->present)
@@ -107,7 +117,110 @@ bool randr_is_active(xcb_connection_t *xcb)
     return true;
 }
 
-static bool randr_has_monitors(xcb_connection_t *xcb)
+bool xfixes_is_active(xcb_connection_t *xcb)
+{
+    if (!xcb || !xcb_get_extension_data(xcb, &xcb_xfixes_id)->present)
+        return false;
+
+    xcb_xfixes_query_version_cookie_t ver_c;
+    xcb_xfixes_query_version_reply_t *ver_r;
+
+    ver_c = xcb_xfixes_query_version(xcb, XCB_XFIXES_MAJOR_VERSION,
+                                     XCB_XFIXES_MINOR_VERSION);
+    ver_r = xcb_xfixes_query_version_reply(xcb, ver_c, NULL);
+
+    bool active = ver_r && ver_r->major_version >= 2;
+    free(ver_r);
+
+    return active;
+}
+
+bool xdamage_is_active(xcb_connection_t *xcb)
+{
+    if (!xcb || !xcb_get_extension_data(xcb, &xcb_damage_id)->present)
+        return false;
+
+    xcb_damage_query_version_cookie_t ver_c;
+    xcb_damage_query_version_reply_t *ver_r;
+
+    ver_c = xcb_damage_query_version(xcb, XCB_DAMAGE_MAJOR_VERSION,
+                                     XCB_DAMAGE_MINOR_VERSION);
+    ver_r = xcb_damage_query_version_reply(xcb, ver_c, NULL);
+
+    bool active = ver_r != NULL;
+    free(ver_r);
+
+    return active;
+}
+
+bool xinput_is_active(xcb_connection_t *xcb)
+{
+    if (!xcb || !xcb_get_extension_data(xcb, &xcb_input_id)->present)
+        return false;
+
+    xcb_input_xi_query_version_cookie_t ver_c;
+    xcb_input_xi_query_version_reply_t *ver_r;
+
+    ver_c = xcb_input_xi_query_version(xcb, 2, 0);
+    ver_r = xcb_input_xi_query_version_reply(xcb, ver_c, NULL);
+
+    bool active = ver_r && ver_r->major_version >= 2;
+    free(ver_r);
+
+    return active;
+}
+
+bool xcomposite_is_active(xcb_connection_t *xcb)
+{
+    if (!xcb || !xcb_get_extension_data(xcb, &xcb_composite_id)->present)
+        return false;
+
+    xcb_composite_query_version_cookie_t ver_c;
+    xcb_composite_query_version_reply_t *ver_r;
+
+    ver_c = xcb_composite_query_version(xcb, XCB_COMPOSITE_MAJOR_VERSION,
+                                        XCB_COMPOSITE_MINOR_VERSION);
+    ver_r = xcb_composite_query_version_reply(xcb, ver_c, NULL);
+
+    bool active = ver_r && (ver_r->major_version > 0 || ver_r->minor_version >= 2);
+    free(ver_r);
+
+    return active;
+}
+
+int x11_window_geo(xcb_connection_t *xcb, xcb_window_t window, int_fast32_t *x,
+                   int_fast32_t *y, int_fast32_t *w, int_fast32_t *h,
+                   int_fast32_t *border, xcb_window_t *root)
+{
+    xcb_get_geometry_reply_t *geo_r =
+            xcb_get_geometry_reply(xcb, xcb_get_geometry(xcb, window), NULL);
+    if (!geo_r)
+        goto fail;
+
+    xcb_translate_coordinates_reply_t *pos_r = xcb_translate_coordinates_reply(
+            xcb, xcb_translate_coordinates(xcb, window, geo_r->root, 0, 0), NULL);
+    if (!pos_r) {
+        free(geo_r);
+        goto fail;
+    }
+
+    *x = pos_r->dst_x;
+    *y = pos_r->dst_y;
+    *w = geo_r->width;
+    *h = geo_r->height;
+    *border = geo_r->border_width;
+    *root = geo_r->root;
+
+    free(pos_r);
+    free(geo_r);
+    return 0;
+
+fail:
+    *x = *y = *w = *h = *border = 0;
+    return -1;
+}
+
+bool randr_has_monitors(xcb_connection_t *xcb)
 {
     xcb_randr_query_version_cookie_t ver_c;
     xcb_randr_query_version_reply_t *ver_r;
@@ -123,14 +236,14 @@ static bool randr_has_monitors(xcb_connection_t *xcb)
     return ret;
 }
 
-int randr_screen_count(xcb_connection_t *xcb)
+int randr_screen_count(xcb_connection_t *xcb, bool has_monitors)
 {
     if (!xcb)
         return 0;
     xcb_screen_t *screen;
     screen = xcb_setup_roots_iterator(xcb_get_setup(xcb)).data;
 
-    if (randr_has_monitors(xcb)) {
+    if (has_monitors) {
         xcb_randr_get_monitors_cookie_t mon_c;
         xcb_randr_get_monitors_reply_t *mon_r;
 
@@ -151,24 +264,26 @@ int randr_screen_count(xcb_connection_t *xcb)
     if (!res_r)
         return 0;
 
-    return xcb_randr_get_screen_resources_crtcs_length(res_r);
+    int count = xcb_randr_get_screen_resources_crtcs_length(res_r);
+    free(res_r);
+    return count;
 }
 
-int randr_screen_geo(xcb_connection_t *xcb, int_fast32_t screen,
+int randr_screen_geo(xcb_connection_t *xcb, bool has_monitors, int_fast32_t screen,
                      int_fast32_t *x, int_fast32_t *y, int_fast32_t *w,
                      int_fast32_t *h, xcb_screen_t **rscreen, char **name)
 {
     xcb_screen_t *xscreen;
     xscreen = xcb_setup_roots_iterator(xcb_get_setup(xcb)).data;
 
-    if (randr_has_monitors(xcb)) {
+    if (has_monitors) {
         xcb_randr_get_monitors_cookie_t mon_c;
         xcb_randr_get_monitors_reply_t *mon_r;
 
         mon_c = xcb_randr_get_monitors(xcb, xscreen->root, true);
         mon_r = xcb_randr_get_monitors_reply(xcb, mon_c, 0);
         if (!mon_r)
-            return 0;
+            goto fail;
 
         int monitors = xcb_randr_get_monitors_monitors_length(mon_r);
         if (screen < 0 || screen >= monitors) {
@@ -217,8 +332,10 @@ int randr_screen_geo(xcb_connection_t *xcb, int_fast32_t screen,
         goto fail;
 
     int screens = xcb_randr_get_screen_resources_crtcs_length(res_r);
-    if (screen < 0 || screen >= screens)
+    if (screen < 0 || screen >= screens) {
+        free(res_r);
         goto fail;
+    }
 
     xcb_randr_crtc_t *crtc = xcb_randr_get_screen_resources_crtcs(res_r);
 
@@ -227,6 +344,7 @@ int randr_screen_geo(xcb_connection_t *xcb, int_fast32_t screen,
 
     crtc_c = xcb_randr_get_crtc_info(xcb, *(crtc + screen), 0);
     crtc_r = xcb_randr_get_crtc_info_reply(xcb, crtc_c, 0);
+    free(res_r);
     if (!crtc_r)
         goto fail;
 
@@ -234,6 +352,7 @@ int randr_screen_geo(xcb_connection_t *xcb, int_fast32_t screen,
     *y = crtc_r->y;
     *w = crtc_r->width;
     *h = crtc_r->height;
+    free(crtc_r);
 
     if (rscreen)
         *rscreen = xscreen;
@@ -271,7 +390,121 @@ int x11_screen_geo(xcb_connection_t *xcb, int_fast32_t screen, int_fast32_t *w,
     return -1;
 }
 
-xcb_shm_t *xshm_xcb_attach(xcb_connection_t *xcb, const int w, const int h)
+bool xshm_has_fd_passing(xcb_connection_t *xcb)
+{
+    if (!xcb)
+        return false;
+
+    xcb_shm_query_version_cookie_t ver_c;
+    xcb_shm_query_version_reply_t *ver_r;
+
+    ver_c = xcb_shm_query_version(xcb);
+    ver_r = xcb_shm_query_version_reply(xcb, ver_c, NULL);
+
+    bool ok = ver_r && (ver_r->major_version > 1 ||
+                        (ver_r->major_version == 1 && ver_r->minor_version >= 2));
+    free(ver_r);
+
+    return ok;
+}
+
+/**
+ * Create a memfd of at least size bytes and map it, preferring huge pages
+ *
+ * @return fd or -1 on error
+ */
+static int xshm_memfd_map(size_t *size, uint8_t **data)
+{
+    size_t huge_size = (*size + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+    void *map;
+    int fd;
+
+    // succeeds only if the admin has reserved huge pages (vm.nr_hugepages)
+    fd = memfd_create("wlxshm", MFD_CLOEXEC | MFD_HUGETLB);
+    if (fd >= 0) {
+        if (ftruncate(fd, (off_t) huge_size) == 0) {
+            map = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                *size = huge_size;
+                *data = map;
+                return fd;
+            }
+        }
+        close(fd);
+    }
+
+    fd = memfd_create("wlxshm", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, (off_t) *size) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    *data = map;
+    return fd;
+}
+
+static bool xshm_attach_memfd(xcb_shm_t *shm)
+{
+    int fd = xshm_memfd_map(&shm->size, &shm->data);
+    if (fd < 0)
+        return false;
+
+    // xcb closes the fd once it has been sent
+    xcb_void_cookie_t att_c = xcb_shm_attach_fd_checked(shm->xcb, shm->seg, fd, false);
+    xcb_generic_error_t *err = xcb_request_check(shm->xcb, att_c);
+    if (err) {
+        free(err);
+        munmap(shm->data, shm->size);
+        shm->data = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static bool xshm_attach_sysv(xcb_shm_t *shm)
+{
+    shm->shmid = shmget(IPC_PRIVATE, shm->size, IPC_CREAT | 0600);
+    if (shm->shmid == -1)
+        return false;
+
+    shm->data = shmat(shm->shmid, NULL, 0);
+    if ((char *)shm->data == (char *)-1) {
+        shm->data = NULL;
+        shmctl(shm->shmid, IPC_RMID, NULL);
+        shm->shmid = -1;
+        return false;
+    }
+
+    xcb_void_cookie_t att_c = xcb_shm_attach_checked(shm->xcb, shm->seg, shm->shmid, false);
+    xcb_generic_error_t *err = xcb_request_check(shm->xcb, att_c);
+
+    // removed once both we and the X server have detached,
+    // only marked after the attach so it does not depend on attaching a removed segment
+    shmctl(shm->shmid, IPC_RMID, NULL);
+
+    if (err) {
+        free(err);
+        shmdt(shm->data);
+        shm->data = NULL;
+        shm->shmid = -1;
+        return false;
+    }
+
+    return true;
+}
+
+xcb_shm_t *xshm_xcb_attach(xcb_connection_t *xcb, const int w, const int h,
+                           bool use_fd)
 {
     if (!xcb)
         return NULL;
@@ -280,18 +513,17 @@ xcb_shm_t *xshm_xcb_attach(xcb_connection_t *xcb, const int w, const int h)
 
     shm->xcb = xcb;
     shm->seg = xcb_generate_id(shm->xcb);
+    shm->shmid = -1;
+    shm->size = (size_t) w * h * 4;
 
-    shm->shmid = shmget(IPC_PRIVATE, w * h * 4, IPC_CREAT | 0777);
-    if (shm->shmid == -1)
-        goto fail;
-
-    xcb_shm_attach(shm->xcb, shm->seg, shm->shmid, false);
+    if (use_fd && xshm_attach_memfd(shm))
+        return shm;
 
-    shm->data = shmat(shm->shmid, NULL, 0);
+    shm->size = (size_t) w * h * 4;
+    if (xshm_attach_sysv(shm))
+        return shm;
 
-    return shm;
-    fail:
-    xshm_xcb_detach(shm);
+    free(shm);
     return NULL;
 }
 
@@ -302,11 +534,10 @@ void xshm_xcb_detach(xcb_shm_t *shm)
 
     xcb_shm_detach(shm->xcb, shm->seg);
 
-    if ((char *)shm->data != (char *)-1)
-        shmdt(shm->data);
-
     if (shm->shmid != -1)
-        shmctl(shm->shmid, IPC_RMID, NULL);
+        shmdt(shm->data);
+    else
+        munmap(shm->data, shm->size);
 
     free(shm);
 }
@@ -29,6 +29,7 @@ typedef struct {
     xcb_connection_t *xcb;
     xcb_shm_seg_t seg;
     int shmid;
+    size_t size;
     uint8_t *data;
 } xcb_shm_t;
 
@@ -71,12 +72,74 @@ int xinerama_screen_geo(xcb_connection_t *xcb, int_fast32_t screen,
  */
 bool randr_is_active(xcb_connection_t *xcb);
 
+/**
+ * Check for XFixes extension
+ *
+ * @note This negotiates the extension version, which is required before
+ *       any regions or cursor requests may be used.
+ *
+ * @return true if XFixes 2.0 or later is available
+ */
+bool xfixes_is_active(xcb_connection_t *xcb);
+
+/**
+ * Check for Damage extension
+ *
+ * @note Requires xfixes_is_active to have succeeded.
+ *
+ * @return true if damage tracking is available
+ */
+bool xdamage_is_active(xcb_connection_t *xcb);
+
+/**
+ * Check for Composite extension
+ *
+ * @return true if windows can be redirected and named as pixmaps (0.2+)
+ */
+bool xcomposite_is_active(xcb_connection_t *xcb);
+
+/**
+ * Get the geometry of a window
+ *
+ * @note On error the passed coordinates/sizes will be set to 0.
+ *
+ * @param xcb xcb connection
+ * @param window window to get geometry for
+ * @param x x-coordinate of the window contents on the root window
+ * @param y y-coordinate of the window contents on the root window
+ * @param w width of the window, without border
+ * @param h height of the window, without border
+ * @param border width of the window border
+ * @param root root window the window belongs to
+ *
+ * @return < 0 on error
+ */
+int x11_window_geo(xcb_connection_t *xcb, xcb_window_t window, int_fast32_t *x,
+                   int_fast32_t *y, int_fast32_t *w, int_fast32_t *h,
+                   int_fast32_t *border, xcb_window_t *root);
+
+/**
+ * Check for XInput extension
+ *
+ * @return true if XInput 2.0 or later is available
+ */
+bool xinput_is_active(xcb_connection_t *xcb);
+
+/**
+ * Check whether Randr is recent enough (1.5) to report monitors
+ *
+ * @note This costs a round trip, the result should be cached by the caller.
+ */
+bool randr_has_monitors(xcb_connection_t *xcb);
+
 /**
  * Get the number of Randr screens
  *
+ * @param has_monitors result of randr_has_monitors
+ *
  * @return number of screens
  */
-int randr_screen_count(xcb_connection_t *xcb);
+int randr_screen_count(xcb_connection_t *xcb, bool has_monitors);
 
 /**
  * Get screen geometry for a Rand crtc (screen)
@@ -84,6 +147,7 @@ int randr_screen_count(xcb_connection_t *xcb);
  * @note On error the passed coordinates/sizes will be set to 0.
  *
  * @param xcb xcb connection
+ * @param has_monitors result of randr_has_monitors
  * @param screen screen number to get geometry for
  * @param x x-coordinate of the screen
  * @param y y-coordinate of the screen
@@ -92,7 +156,7 @@ int randr_screen_count(xcb_connection_t *xcb);
  *
  * @return < 0 on error
  */
-int randr_screen_geo(xcb_connection_t *xcb, int_fast32_t screen,
+int randr_screen_geo(xcb_connection_t *xcb, bool has_monitors, int_fast32_t screen,
                      int_fast32_t *x, int_fast32_t *y, int_fast32_t *w,
                      int_fast32_t *h, xcb_screen_t **rscreen, char **name);
 
@@ -111,16 +175,28 @@ int randr_screen_geo(xcb_connection_t *xcb, int_fast32_t screen,
 int x11_screen_geo(xcb_connection_t *xcb, int_fast32_t screen, int_fast32_t *w,
                    int_fast32_t *h);
 
+/**
+ * Check whether the SHM extension accepts segments passed as file descriptors
+ *
+ * @return true if SHM 1.2 or later is available
+ */
+bool xshm_has_fd_passing(xcb_connection_t *xcb);
+
 /**
  * Attach a shared memory segment to the X-Server
  *
+ * @note With use_fd, the segment is a memfd (backed by huge pages if any are
+ *       reserved), otherwise or on failure a SysV segment is used.
+ *
  * @param xcb xcb connection
  * @param w width of the captured screen
  * @param h height of the captured screen
+ * @param use_fd whether the X server supports fd passing
  *
  * @return NULL on error
  */
-xcb_shm_t *xshm_xcb_attach(xcb_connection_t *xcb, const int w, const int h);
+xcb_shm_t *xshm_xcb_attach(xcb_connection_t *xcb, const int w, const int h,
+                           bool use_fd);
 
 /**
  * Detach a shared memory segment
@@ -8,6 +8,12 @@ cmake --build . -j$(nproc)
 mv libwlxpw.so ../../
 cd ../..
 
+cd lib/wlxdiff || exit 1
+cmake .
+cmake --build . -j$(nproc)
+mv libwlxdiff.so ../../
+cd ../..
+
 cd lib/wlxshm || exit 1
 cmake .
 cmake --build . -j$(nproc)